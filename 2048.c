@@ -1,66 +1,64 @@
 #include <curses.h>
+#include <math.h>
+#include <pthread.h>
 #include <time.h>
 #include <signal.h>
-#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <stdint.h>
-#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
-// 2^11 = 2048
-#define TARGET_TILE   11
-#define INITIAL_TILES 2
-#define TILE_WIDTH    8
-#define TILE_HEIGHT   3
-#define TILES_PER_DIM 4
-
-#define i8  int8_t
-#define u8  uint8_t
-#define u32 uint32_t
-
-#define align(n) __attribute__((aligned(n)))
+#include "internal.h"
 
-#define FOR(i, s, n) \
-  for(i8 i = s; i < n; ++i)
+// the server needs epoll
+#if defined(PACKED) && defined(__linux__)
+#define HAVE_SERVER 1
+#include <endian.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
-#define FOR_TILES(i, j) \
-  FOR(i, 0, TILES_PER_DIM) \
-  FOR(j, 0, TILES_PER_DIM)
-
-#define EQ(a, b) \
-  (memcmp((a), (b), sizeof(*(a))) == 0)
-
-// If a tile at (i, j) is present, tiles[i][j] contains its log_2 value.
-// If a tile at (i, j) is not present, tiles[i][j] = 0.
-struct board {
-  u8 tiles[TILES_PER_DIM][TILES_PER_DIM] align(16);
-};
+#define TILE_WIDTH    8
+#define TILE_HEIGHT   3
+// the longest hint under the board, and its NUL
+#define HINT_LEN      24
+// the most --threads or --search-threads may ask for
+#define MAX_THREADS   1024
 
-struct game {
-  struct board board;
-  u32          score;
-  unsigned     seed;
-};
+static void rep(char c, int n) { for(int i = 0; i < n; ++i) addch(c); }
 
-static char itoc(u8 x, char zero) { return x == 0 ? zero : (x + '0'); }
-static void rep(char c, i8 n)     { FOR(i, 0, n) addch(c); }
+// glyphs[x] is the tile 2^x, centered in TILE_WIDTH columns: right-aligned
+// in four columns up to 9999, as wide as the number past that, and 2^x once
+// the number no longer fits
+static char glyphs[256][TILE_WIDTH + 1];
 
-// draws nothing if x == 0
-static void draw_u8(int x) {
-  x = x == 0 ? 0 : (1 << x);
-  int hspace = TILE_WIDTH - 4;
-  int left_hspace = hspace / 2;
-  int right_hspace = hspace - left_hspace;
-  rep(' ', left_hspace);
-  int div = 1000;
-  FOR(i, 0, 4) {
-    addch(itoc(
-      (x / div) % 10,
-      x < div ? ' ' : '0'));
-    div /= 10;
+static void init_glyphs(void) {
+  memset(glyphs[0], ' ', TILE_WIDTH);
+  for(int x = 1; x < 256; ++x) {
+    memset(glyphs[x], ' ', TILE_WIDTH);
+    char digits[32];
+    int  n = x < 64 ? snprintf(digits, sizeof(digits), "%llu", 1ull << x)
+                    : TILE_WIDTH + 1;
+    if(n > TILE_WIDTH) n = snprintf(digits, sizeof(digits), "2^%d", x);
+    int width = n < 4 ? 4 : n;
+    int left  = (TILE_WIDTH - width) / 2;
+    memcpy(glyphs[x] + left + width - n, digits, n);
   }
-  rep(' ', right_hspace);
 }
 
+// draws nothing if x == 0
+static void draw_u8(u8 x) { addnstr(glyphs[x], TILE_WIDTH); }
+
 static void h_line(char v_edge, char h_edge, int lspace) {
   rep(' ', lspace);
   FOR(i, 0, TILES_PER_DIM) {
@@ -72,7 +70,7 @@ static void h_line(char v_edge, char h_edge, int lspace) {
 }
 
 static void h_lines(char v_edge, char h_edge, int lspace, int n) {
-  FOR(i, 0, n) h_line(v_edge, h_edge, lspace);
+  for(int i = 0; i < n; ++i) h_line(v_edge, h_edge, lspace);
 }
 
 static void draw_tile_contents_row(const u8 row[TILES_PER_DIM], int lspace) {
@@ -85,16 +83,24 @@ static void draw_tile_contents_row(const u8 row[TILES_PER_DIM], int lspace) {
   addch('\n');
 }
 
-static void print(const struct game* g) {
+static int lspace_of(int x) {
+  return (x - ((1 + TILE_WIDTH ) * TILES_PER_DIM + 1)) / 2;
+}
+
+static int tspace_of(int y) {
+  return (y - ((1 + TILE_HEIGHT) * TILES_PER_DIM + 1)) / 2 - 3;
+}
+
+static void print(const struct g2048_game* g, const char* hint) {
   int x, y;
   getmaxyx(stdscr, y, x);
-  int lspace = (x - ((1 + TILE_WIDTH ) * TILES_PER_DIM + 1)) / 2;
-  int tspace = (y - ((1 + TILE_HEIGHT) * TILES_PER_DIM + 1)) / 2 - 3;
+  int lspace = lspace_of(x);
+  int tspace = tspace_of(y);
   int top_vspace = (TILE_HEIGHT - 1) / 2;
   int bot_vspace = (TILE_HEIGHT - 1) - top_vspace;
   rep('\n', tspace);
   rep(' ', x/2 - 5);
-  printw("Score: %d", g->score);
+  printw("Score: %lu", g->score);
   rep('\n', 2);
   FOR(i, 0, TILES_PER_DIM) {
     h_line('+', '-', lspace);
@@ -103,151 +109,3123 @@ static void print(const struct game* g) {
     h_lines('|', ' ', lspace, bot_vspace);
   }
   h_line('+', '-', lspace);
+  rep(' ', x/2 - 5);
+  printw("%-*.*s", HINT_LEN - 1, HINT_LEN - 1, hint);
 }
 
-static void draw(const struct game* g) {
-  move(0, 0);
-  print(g);
+// What draw last put on the screen, and where, so it only has to repaint
+// what changed. The whole frame is printed at first and after a resize.
+// Hints are copied, so a caller can reuse its buffer for the next one.
+struct screen {
+  int                lines, cols;
+  int                top, left, middle;
+  struct g2048_board shown;
+  u64                score;
+  char               hint[HINT_LEN];
+};
+
+static int max(int a, int b) { return a > b ? a : b; }
+
+// [hint] is shown under the board; 'h' asks the solver for one
+static void draw(struct screen* sc, const struct g2048_game* g,
+                 const char* hint) {
+  PROBE(PROBE_DRAW);
+  int x, y;
+  getmaxyx(stdscr, y, x);
+  if(y != sc->lines || x != sc->cols) {
+    erase();
+    move(0, 0);
+    print(g, hint);
+    sc->lines  = y;
+    sc->cols   = x;
+    sc->top    = max(tspace_of(y), 0) + 2;
+    sc->left   = max(lspace_of(x), 0) + 1;
+    sc->middle = max(x/2 - 5, 0);
+  } else {
+    FOR_TILES(i, j) {
+      if(sc->shown.tiles[i][j] == g->board.tiles[i][j]) continue;
+      move(sc->top + i * (1 + TILE_HEIGHT) + 1 + (TILE_HEIGHT - 1) / 2,
+           sc->left + j * (1 + TILE_WIDTH));
+      draw_u8(g->board.tiles[i][j]);
+    }
+    // the score can shrink, with undo or a new game, so clear what's left
+    if(sc->score != g->score) {
+      mvprintw(sc->top - 2, sc->middle, "Score: %lu", g->score);
+      clrtoeol();
+    }
+    if(strncmp(sc->hint, hint, HINT_LEN - 1) != 0)
+      mvprintw(sc->top + TILES_PER_DIM * (1 + TILE_HEIGHT) + 1, sc->middle,
+               "%-*.*s", HINT_LEN - 1, HINT_LEN - 1, hint);
+  }
+  sc->shown = g->board;
+  sc->score = g->score;
+  snprintf(sc->hint, HINT_LEN, "%s", hint);
   refresh();
 }
 
-i8 count_zeros(const struct board* b) {
-  i8 zeros = 0;
-  FOR_TILES(i, j) zeros += b->tiles[i][j] == 0;
-  return zeros;
+static i8 dir_of_key(int key) {
+  switch(key) {
+  case KEY_LEFT:  return LEFT;
+  case KEY_DOWN:  return DOWN;
+  case KEY_RIGHT: return RIGHT;
+  case KEY_UP:    return UP;
+  default:        return -1;
+  }
+}
+
+
+#ifdef PACKED
+// A batch plays many games in lockstep, one to a lane. Each lane's packed
+// board, score, rng state, next move and whether it is lost are kept in
+// arrays of their own, so a kernel loads several lanes with one instruction.
+// step_batch makes every lane's move, unless it is lost or its move is -1,
+// and spawns a tile and checks for a loss wherever the board changed: the
+// same games update would play. Lanes past [lanes] are kept lost.
+#define BATCH_ALIGN 8
+
+struct batch {
+  u32  lanes;
+  u64* boards;
+  u32* scores;  // packed boards score less than 2^32
+  u32* rng[4];
+  i8*  moves;
+  u8*  lost;
+};
+
+static struct batch new_batch(u32 lanes) {
+  u32 n = (lanes + BATCH_ALIGN - 1) / BATCH_ALIGN * BATCH_ALIGN;
+  struct batch b =
+    { .lanes  = lanes
+    , .boards = calloc(n, sizeof(u64))
+    , .scores = calloc(n, sizeof(u32))
+    , .moves  = malloc(n)
+    , .lost   = malloc(n)
+    };
+  FOR(k, 0, 4) b.rng[k] = calloc(n, sizeof(u32));
+  memset(b.moves, -1, n);
+  memset(b.lost,   1, n);
+  return b;
+}
+
+static void free_batch(struct batch* b) {
+  free(b->boards);
+  free(b->scores);
+  FOR(k, 0, 4) free(b->rng[k]);
+  free(b->moves);
+  free(b->lost);
+}
+
+static void set_lane(struct batch* b, u32 l, const struct g2048_game* g) {
+  b->boards[l] = g2048_pack_board(&g->board);
+  b->scores[l] = g->score;
+  FOR(k, 0, 4) b->rng[k][l] = g->rng.s[k];
+  b->lost[l] = g2048_is_loss(&g->board);
+}
+
+static struct g2048_game lane_game(const struct batch* b, u32 l) {
+  struct g2048_game g = { .score = b->scores[l] };
+  g2048_unpack_board(b->boards[l], &g.board);
+  FOR(k, 0, 4) g.rng.s[k] = b->rng[k][l];
+  return g;
+}
+
+static void step_lane(struct batch* b, u32 l) {
+  i8 dir = b->moves[l];
+  if(b->lost[l] || dir < 0) return;
+  struct g2048_game g = lane_game(b, l);
+  if(g2048_update(&g, dir)) set_lane(b, l, &g);
+}
+
+static void scalar_step(struct batch* b, u32 l) { step_lane(b, l); }
+
+// The vector kernels step one register of lanes at a time. Each lane's move
+// becomes a left or right move of the rows of its board, or of its
+// transpose, so every lane is one table gather per row. A new tile goes in
+// the empty nibble whose running count of empty nibbles reaches the drawn
+// index. A lane whose draws land where rng_below would redraw is left to
+// step_lane instead. Loss is no empty tile and no equal neighbours, which
+// only differs from the tables for a pair of 2^15 tiles.
+#if TILES_PER_DIM == 4 && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_LANES 1
+#define AVX2   __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx2,avx512f,avx512bw,avx512vl")))
+
+// moved rows, left then right, widened to u32 for the gathers
+static u32 lane_rows[2 * ROWS];
+
+static void init_lane_tables(void) {
+  for(u32 r = 0; r < ROWS; ++r) {
+    lane_rows[r]        = g2048_row_left [r];
+    lane_rows[ROWS + r] = g2048_row_right[r];
+  }
 }
 
-static void new_tile(struct board* b, unsigned* seed) {
-  i8 zeros = count_zeros(b);
-  i8 tile = rand_r(seed) % zeros;
-  // 10% chance of 4, 90% chance of 2
-  u8 tile_size = 1 + (rand_r(seed) % 10 < 1);
-  FOR_TILES(i, j) {
-    if(b->tiles[i][j] == 0 && tile-- == 0)
-      b->tiles[i][j] = tile_size;
+// the per-lane values the kernels need from moves and lost
+struct lane_masks {
+  u64 active[8];
+  u64 vertical[8];
+  u64 offset[8];
+};
+
+static void lane_masks(const struct batch* b, u32 l, i8 width,
+                       struct lane_masks* m) {
+  FOR(i, 0, width) {
+    i8 dir = b->moves[l + i];
+    m->active  [i] = -(u64)(dir >= 0 && !b->lost[l + i]);
+    m->vertical[i] = -(u64)(dir == UP || dir == DOWN);
+    m->offset  [i] = dir == RIGHT || dir == DOWN ? ROWS : 0;
   }
 }
 
-static void rotate_cw(struct board* b) {
-  struct board r;
-  FOR_TILES(i, j) r.tiles[i][j] = b->tiles[4-j-1][i];
-  *b = r;
+#define LOW_NIBBLES 0x1111111111111111ull
+// the nibbles with a right neighbour, and those with one below
+#define HAS_RIGHT   0x0111011101110111ull
+#define HAS_BELOW   0x0000111111111111ull
+
+AVX2 static __m256i avx2_or_nibble(__m256i x) {
+  return _mm256_or_si256(
+    _mm256_or_si256(x, _mm256_srli_epi64(x, 1)),
+    _mm256_or_si256(_mm256_srli_epi64(x, 2), _mm256_srli_epi64(x, 3)));
+}
+
+// the low bit of each nibble in [mask] that is zero in [x]
+AVX2 static __m256i avx2_zeros(__m256i x, u64 mask) {
+  return _mm256_andnot_si256(avx2_or_nibble(x), _mm256_set1_epi64x(mask));
 }
 
-static void move_nonzero_first(u8 row[TILES_PER_DIM]) {
-  i8 start_of_zeros = 0;
-  FOR(i, 0, TILES_PER_DIM) {
-    if(row[i] == 0) continue;
-    // consider the case [i == start_of_zeros]
-    u8 t = row[i];
-    row[i] = 0;
-    row[start_of_zeros++] = t;
+AVX2 static __m256i avx2_transpose(__m256i p) {
+#define M(c) _mm256_set1_epi64x(c)
+  __m256i a = _mm256_or_si256(_mm256_and_si256(p, M(0xf0f00f0ff0f00f0full)),
+    _mm256_or_si256(
+      _mm256_slli_epi64(_mm256_and_si256(p, M(0x0000f0f00000f0f0ull)), 12),
+      _mm256_srli_epi64(_mm256_and_si256(p, M(0x0f0f00000f0f0000ull)), 12)));
+  return _mm256_or_si256(_mm256_and_si256(a, M(0xff00ff0000ff00ffull)),
+    _mm256_or_si256(
+      _mm256_srli_epi64(_mm256_and_si256(a, M(0x00ff00ff00000000ull)), 24),
+      _mm256_slli_epi64(_mm256_and_si256(a, M(0x00000000ff00ff00ull)), 24)));
+#undef M
+}
+
+AVX2 static __m128i avx2_rotl(__m128i x, int k) {
+  return _mm_or_si128(_mm_slli_epi32(x, k), _mm_srli_epi32(x, 32 - k));
+}
+
+// rng_next in four lanes
+AVX2 static __m128i avx2_rng_next(__m128i s[4]) {
+  __m128i x = avx2_rotl(_mm_add_epi32(s[1], _mm_slli_epi32(s[1], 2)), 7);
+  x = _mm_add_epi32(x, _mm_slli_epi32(x, 3));
+  __m128i t = _mm_slli_epi32(s[1], 9);
+  s[2] = _mm_xor_si128(s[2], s[0]);
+  s[3] = _mm_xor_si128(s[3], s[1]);
+  s[1] = _mm_xor_si128(s[1], s[2]);
+  s[0] = _mm_xor_si128(s[0], s[3]);
+  s[2] = _mm_xor_si128(s[2], t);
+  s[3] = avx2_rotl(s[3], 11);
+  return x;
+}
+
+AVX2 static void avx2_step(struct batch* b, u32 l) {
+  struct lane_masks lm;
+  lane_masks(b, l, 4, &lm);
+  __m256i active   = _mm256_loadu_si256((const __m256i*)lm.active);
+  __m256i vertical = _mm256_loadu_si256((const __m256i*)lm.vertical);
+  __m256i offset   = _mm256_loadu_si256((const __m256i*)lm.offset);
+  __m256i zero     = _mm256_setzero_si256();
+  __m256i low32    = _mm256_set1_epi64x(0xffffffffull);
+  __m256i p = _mm256_loadu_si256((const __m256i*)(b->boards + l));
+
+  __m256i t = _mm256_blendv_epi8(p, avx2_transpose(p), vertical);
+  __m256i r = zero;
+  __m128i points = _mm_setzero_si128();
+  FOR(i, 0, 4) {
+    __m256i row = _mm256_and_si256(_mm256_srli_epi64(t, 16 * i),
+                                   _mm256_set1_epi64x(0xffff));
+    __m128i moved = _mm256_i64gather_epi32(
+      (const int*)lane_rows, _mm256_add_epi64(row, offset), 4);
+    r = _mm256_or_si256(r,
+      _mm256_slli_epi64(_mm256_cvtepu32_epi64(moved), 16 * i));
+    points = _mm_add_epi32(points,
+      _mm256_i64gather_epi32((const int*)g2048_row_score, row, 4));
+  }
+  __m256i moved   = _mm256_blendv_epi8(r, avx2_transpose(r), vertical);
+  __m256i changed = _mm256_andnot_si256(_mm256_cmpeq_epi64(moved, p), active);
+
+  __m128i s0[4], s[4];
+  FOR(k, 0, 4) s0[k] = s[k] = _mm_loadu_si128((const __m128i*)(b->rng[k] + l));
+  __m256i empty = avx2_zeros(moved, LOW_NIBBLES);
+  __m256i ones  = _mm256_set1_epi8(1);
+  __m256i n     = _mm256_sad_epu8(_mm256_add_epi8(_mm256_and_si256(empty, ones),
+    _mm256_and_si256(_mm256_srli_epi64(empty, 4), ones)), zero);
+  __m256i ten   = _mm256_set1_epi64x(10);
+  __m256i m1 = _mm256_mul_epu32(_mm256_cvtepu32_epi64(avx2_rng_next(s)), n);
+  __m256i m2 = _mm256_mul_epu32(_mm256_cvtepu32_epi64(avx2_rng_next(s)), ten);
+  __m256i redraw = _mm256_and_si256(changed, _mm256_or_si256(
+    _mm256_cmpgt_epi64(n,   _mm256_and_si256(m1, low32)),
+    _mm256_cmpgt_epi64(ten, _mm256_and_si256(m2, low32))));
+  __m256i go = _mm256_andnot_si256(redraw, changed);
+
+  // running counts of empty nibbles, against the drawn index + 1 in every
+  // nibble; at most 15 are empty after a move, so neither overflows
+  __m256i count = empty, index = _mm256_add_epi64(_mm256_srli_epi64(m1, 32),
+                                                  _mm256_set1_epi64x(1));
+  FOR(k, 0, 4) {
+    count = _mm256_add_epi64(count, _mm256_slli_epi64(count, 4 << k));
+    index = _mm256_or_si256 (index, _mm256_slli_epi64(index, 4 << k));
+  }
+  __m256i at = _mm256_andnot_si256(
+    avx2_or_nibble(_mm256_xor_si256(count, index)), empty);
+  __m256i four = _mm256_cmpeq_epi64(_mm256_srli_epi64(m2, 32), zero);
+  __m256i q = _mm256_or_si256(moved,
+    _mm256_sllv_epi64(at, _mm256_srli_epi64(four, 63)));
+  q = _mm256_blendv_epi8(p, q, go);
+  _mm256_storeu_si256((__m256i*)(b->boards + l), q);
+
+  __m128i go32 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(go,
+    _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7)));
+  __m128i* scores = (__m128i*)(b->scores + l);
+  _mm_storeu_si128(scores, _mm_add_epi32(_mm_loadu_si128(scores),
+    _mm_and_si128(points, go32)));
+  FOR(k, 0, 4)
+    _mm_storeu_si128((__m128i*)(b->rng[k] + l),
+      _mm_blendv_epi8(s0[k], s[k], go32));
+
+  __m256i open = _mm256_or_si256(avx2_zeros(q, LOW_NIBBLES),
+    _mm256_or_si256(
+      avx2_zeros(_mm256_xor_si256(q, _mm256_srli_epi64(q, 4)),  HAS_RIGHT),
+      avx2_zeros(_mm256_xor_si256(q, _mm256_srli_epi64(q, 16)), HAS_BELOW)));
+  int lost = _mm256_movemask_pd(_mm256_castsi256_pd(
+    _mm256_and_si256(go, _mm256_cmpeq_epi64(open, zero))));
+  int slow = _mm256_movemask_pd(_mm256_castsi256_pd(redraw));
+  FOR(i, 0, 4) {
+    if(lost >> i & 1) b->lost[l + i] = 1;
+    if(slow >> i & 1) step_lane(b, l + i);
+  }
+}
+
+static bool avx2_supported(void) { return __builtin_cpu_supports("avx2"); }
+
+AVX512 static __m512i avx512_or_nibble(__m512i x) {
+  return _mm512_or_si512(
+    _mm512_or_si512(x, _mm512_srli_epi64(x, 1)),
+    _mm512_or_si512(_mm512_srli_epi64(x, 2), _mm512_srli_epi64(x, 3)));
+}
+
+AVX512 static __m512i avx512_zeros(__m512i x, u64 mask) {
+  return _mm512_andnot_si512(avx512_or_nibble(x), _mm512_set1_epi64(mask));
+}
+
+AVX512 static __m512i avx512_transpose(__m512i p) {
+#define M(c) _mm512_set1_epi64(c)
+  __m512i a = _mm512_or_si512(_mm512_and_si512(p, M(0xf0f00f0ff0f00f0full)),
+    _mm512_or_si512(
+      _mm512_slli_epi64(_mm512_and_si512(p, M(0x0000f0f00000f0f0ull)), 12),
+      _mm512_srli_epi64(_mm512_and_si512(p, M(0x0f0f00000f0f0000ull)), 12)));
+  return _mm512_or_si512(_mm512_and_si512(a, M(0xff00ff0000ff00ffull)),
+    _mm512_or_si512(
+      _mm512_srli_epi64(_mm512_and_si512(a, M(0x00ff00ff00000000ull)), 24),
+      _mm512_slli_epi64(_mm512_and_si512(a, M(0x00000000ff00ff00ull)), 24)));
+#undef M
+}
+
+AVX512 static __m256i avx512_rotl(__m256i x, int k) {
+  return _mm256_or_si256(_mm256_slli_epi32(x, k), _mm256_srli_epi32(x, 32 - k));
+}
+
+// rng_next in eight lanes
+AVX512 static __m256i avx512_rng_next(__m256i s[4]) {
+  __m256i x = avx512_rotl(
+    _mm256_add_epi32(s[1], _mm256_slli_epi32(s[1], 2)), 7);
+  x = _mm256_add_epi32(x, _mm256_slli_epi32(x, 3));
+  __m256i t = _mm256_slli_epi32(s[1], 9);
+  s[2] = _mm256_xor_si256(s[2], s[0]);
+  s[3] = _mm256_xor_si256(s[3], s[1]);
+  s[1] = _mm256_xor_si256(s[1], s[2]);
+  s[0] = _mm256_xor_si256(s[0], s[3]);
+  s[2] = _mm256_xor_si256(s[2], t);
+  s[3] = avx512_rotl(s[3], 11);
+  return x;
+}
+
+// see avx2_step
+AVX512 static void avx512_step(struct batch* b, u32 l) {
+  struct lane_masks lm;
+  lane_masks(b, l, 8, &lm);
+  __mmask8 active   = _mm512_test_epi64_mask(
+    _mm512_loadu_si512(lm.active),   _mm512_set1_epi64(1));
+  __mmask8 vertical = _mm512_test_epi64_mask(
+    _mm512_loadu_si512(lm.vertical), _mm512_set1_epi64(1));
+  __m512i  offset   = _mm512_loadu_si512(lm.offset);
+  __m512i  zero     = _mm512_setzero_si512();
+  __m512i  low32    = _mm512_set1_epi64(0xffffffffull);
+  __m512i  p        = _mm512_loadu_si512(b->boards + l);
+
+  __m512i t = _mm512_mask_blend_epi64(vertical, p, avx512_transpose(p));
+  __m512i r = zero;
+  __m256i points = _mm256_setzero_si256();
+  FOR(i, 0, 4) {
+    __m512i row = _mm512_and_si512(_mm512_srli_epi64(t, 16 * i),
+                                   _mm512_set1_epi64(0xffff));
+    __m256i moved = _mm512_i64gather_epi32(
+      _mm512_add_epi64(row, offset), (const int*)lane_rows, 4);
+    r = _mm512_or_si512(r,
+      _mm512_slli_epi64(_mm512_cvtepu32_epi64(moved), 16 * i));
+    points = _mm256_add_epi32(points,
+      _mm512_i64gather_epi32(row, (const int*)g2048_row_score, 4));
+  }
+  __m512i  moved   = _mm512_mask_blend_epi64(vertical, r, avx512_transpose(r));
+  __mmask8 changed = _mm512_mask_cmpneq_epi64_mask(active, moved, p);
+
+  __m256i s0[4], s[4];
+  FOR(k, 0, 4)
+    s0[k] = s[k] = _mm256_loadu_si256((const __m256i*)(b->rng[k] + l));
+  __m512i empty = avx512_zeros(moved, LOW_NIBBLES);
+  __m512i ones  = _mm512_set1_epi8(1);
+  __m512i n     = _mm512_sad_epu8(_mm512_add_epi8(_mm512_and_si512(empty, ones),
+    _mm512_and_si512(_mm512_srli_epi64(empty, 4), ones)), zero);
+  __m512i ten   = _mm512_set1_epi64(10);
+  __m512i m1 = _mm512_mul_epu32(_mm512_cvtepu32_epi64(avx512_rng_next(s)), n);
+  __m512i m2 = _mm512_mul_epu32(_mm512_cvtepu32_epi64(avx512_rng_next(s)), ten);
+  __mmask8 redraw = changed & (
+    _mm512_cmplt_epu64_mask(_mm512_and_si512(m1, low32), n) |
+    _mm512_cmplt_epu64_mask(_mm512_and_si512(m2, low32), ten));
+  __mmask8 go = changed & ~redraw;
+
+  __m512i count = empty, index = _mm512_add_epi64(_mm512_srli_epi64(m1, 32),
+                                                  _mm512_set1_epi64(1));
+  FOR(k, 0, 4) {
+    count = _mm512_add_epi64(count, _mm512_slli_epi64(count, 4 << k));
+    index = _mm512_or_si512 (index, _mm512_slli_epi64(index, 4 << k));
+  }
+  __m512i at = _mm512_andnot_si512(
+    avx512_or_nibble(_mm512_xor_si512(count, index)), empty);
+  __mmask8 four = _mm512_cmpeq_epi64_mask(_mm512_srli_epi64(m2, 32), zero);
+  __m512i q = _mm512_or_si512(moved, _mm512_mask_slli_epi64(at, four, at, 1));
+  q = _mm512_mask_blend_epi64(go, p, q);
+  _mm512_storeu_si512(b->boards + l, q);
+
+  __m256i* scores = (__m256i*)(b->scores + l);
+  __m256i  sc     = _mm256_loadu_si256(scores);
+  _mm256_storeu_si256(scores, _mm256_mask_add_epi32(sc, go, sc, points));
+  FOR(k, 0, 4)
+    _mm256_storeu_si256((__m256i*)(b->rng[k] + l),
+      _mm256_mask_blend_epi32(go, s0[k], s[k]));
+
+  __m512i open = _mm512_or_si512(avx512_zeros(q, LOW_NIBBLES),
+    _mm512_or_si512(
+      avx512_zeros(_mm512_xor_si512(q, _mm512_srli_epi64(q, 4)),  HAS_RIGHT),
+      avx512_zeros(_mm512_xor_si512(q, _mm512_srli_epi64(q, 16)), HAS_BELOW)));
+  __mmask8 lost = go & _mm512_cmpeq_epi64_mask(open, zero);
+  FOR(i, 0, 8) {
+    if(lost   >> i & 1) b->lost[l + i] = 1;
+    if(redraw >> i & 1) step_lane(b, l + i);
+  }
+}
+
+static bool avx512_supported(void) {
+  return __builtin_cpu_supports("avx512f")
+      && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx512vl");
+}
+#endif
+
+// Every way of stepping a batch, fastest first, each [width] lanes at a time.
+struct batch_kernel {
+  const char* name;
+  i8     width;
+  void (*step)(struct batch* b, u32 l);
+  bool (*supported)(void);
+};
+
+static const struct batch_kernel batch_kernels[] =
+  {
+#ifdef HAVE_LANES
+    { "avx512", 8, avx512_step, avx512_supported },
+    { "avx2",   4, avx2_step,   avx2_supported   },
+#endif
+    { "scalar", 1, scalar_step, NULL             },
+  };
+
+#define BATCH_KERNELS (sizeof(batch_kernels) / sizeof(batch_kernels[0]))
+
+static const struct batch_kernel* batch_kernel;
+
+static bool batch_kernel_supported(const struct batch_kernel* k) {
+  return k->supported == NULL || k->supported();
+}
+
+static void init_batch_kernels(void) {
+#ifdef HAVE_LANES
+  init_lane_tables();
+#endif
+  batch_kernel = &batch_kernels[0];
+  while(!batch_kernel_supported(batch_kernel)) ++batch_kernel;
+}
+
+static void step_batch(struct batch* b) {
+  for(u32 l = 0; l < b->lanes; l += batch_kernel->width)
+    batch_kernel->step(b, l);
+}
+#endif
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static FILE* open_or_die(const char* path, const char* mode) {
+  FILE* f = fopen(path, mode);
+  if(f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  return f;
+}
+
+#ifdef PACKED
+// maps all of [path] read-only, its size in [*len]; MAP_FAILED if it is
+// shorter than [min] bytes
+static void* map_file(const char* path, size_t min, size_t* len) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    exit(1);
+  }
+  *len = st.st_size;
+  void* map = *len < min ? MAP_FAILED
+            : mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  return map;
+}
+#endif
+
+#ifdef PACKED
+// An arena hands out memory by bumping a pointer through one mapping, all of
+// which goes back at once when the arena is freed. The mapping is reserved up
+// front and only backed as it is touched: with explicit huge pages if the
+// system has enough set aside, else with transparent ones where the kernel
+// agrees, and on the NUMA node of the thread that touches it first. Memory
+// starts out zero.
+#define ARENA_ALIGN 64
+#define HUGE_PAGE   (2u << 20)
+
+struct arena {
+  u8*         base;
+  size_t      size;
+  size_t      used;
+  u64         allocs;
+  const char* pages;
+  void*       map;
+  size_t      map_len;
+};
+
+static struct arena new_arena(size_t size) {
+  struct arena a = { .pages = "small" };
+  size = (size + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+  a.map_len = size;
+  a.map     = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  a.map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if(a.map != MAP_FAILED) a.pages = "explicit huge";
+#endif
+  a.base = a.map;
+  if(a.map == MAP_FAILED) {
+    // one huge page more, so a huge page boundary starts the arena
+    a.map_len = size + HUGE_PAGE;
+    a.map     = mmap(NULL, a.map_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(a.map == MAP_FAILED) {
+      perror("mmap");
+      exit(1);
+    }
+    a.base = (u8*)(((uintptr_t)a.map + HUGE_PAGE - 1)
+                   & ~(uintptr_t)(HUGE_PAGE - 1));
+#ifdef MADV_HUGEPAGE
+    if(madvise(a.base, size, MADV_HUGEPAGE) == 0) a.pages = "transparent huge";
+#endif
+  }
+#ifdef SYS_mbind
+  // MPOL_LOCAL, whatever the process's policy
+  syscall(SYS_mbind, a.base, size, 4, NULL, 0, 0);
+#endif
+  a.size = size;
+  return a;
+}
+
+static void free_arena(struct arena* a) { munmap(a->map, a->map_len); }
+
+static void* arena_alloc(struct arena* a, size_t n) {
+  size_t at = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if(at + n > a->size) {
+    fprintf(stderr, "arena of %zu bytes is full\n", a->size);
+    exit(1);
   }
+  a->used    = at + n;
+  a->allocs += 1;
+  return a->base + at;
+}
+
+static void print_arena(const char* name, const struct arena* a) {
+  printf("%s arena: %.1f of %.1f MB used in %lu allocations, %s pages\n",
+    name, a->used / 1048576.0, a->size / 1048576.0, a->allocs, a->pages);
+}
+
+// A pool hands out objects of one size from a slab carved out of an arena,
+// and takes them back one at a time. A free object holds the index of the
+// next free one; objects never handed out are past [fresh], untouched.
+#define NO_OBJECT UINT32_MAX
+
+struct pool {
+  u8* slab;
+  u32 size;
+  u32 cap;
+  u32 fresh;
+  u32 free;
+  u32 used;
+  u32 peak;
+};
+
+static struct pool new_pool(struct arena* a, u32 size, u32 cap) {
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  return (struct pool){ .slab = arena_alloc(a, (size_t)size * cap),
+                        .size = size, .cap = cap, .free = NO_OBJECT };
+}
+
+static void* pool_at(const struct pool* p, u32 i) {
+  return p->slab + (size_t)i * p->size;
+}
+
+static u32 pool_index(const struct pool* p, const void* obj) {
+  return ((const u8*)obj - p->slab) / p->size;
+}
+
+// NULL when every object is taken
+static void* pool_take(struct pool* p) {
+  u32 i = p->free;
+  if(i != NO_OBJECT)          memcpy(&p->free, pool_at(p, i), sizeof(u32));
+  else if(p->fresh < p->cap)  i = p->fresh++;
+  else                        return NULL;
+  p->used += 1;
+  p->peak  = p->used > p->peak ? p->used : p->peak;
+  return pool_at(p, i);
 }
 
-static void merge_row_left(u8 row[TILES_PER_DIM]) {
-  move_nonzero_first(row);
-  FOR(i, 0, TILES_PER_DIM - 1) {
-    if(row[i] == 0 || row[i] != row[i+1]) continue;
-    row[i]  += 1;
-    row[i+1] = 0;
+static void pool_give(struct pool* p, void* obj) {
+  memcpy(obj, &p->free, sizeof(u32));
+  p->free  = pool_index(p, obj);
+  p->used -= 1;
+}
+#endif
+
+#ifdef PACKED
+// The solver picks moves by depth-limited expectimax: max nodes try each move,
+// chance nodes average over every tile new_tile could place. A chance node
+// deeper than the depth limit, or less likely than CPROB_MIN to be reached,
+// is scored by the heuristic instead.
+#define CPROB_MIN 0.0001f
+#define TT_BITS   20
+
+static const char* dir_names[] = { "left", "down", "right", "up" };
+
+// The heuristic of a board is the sum over its rows and columns: points for
+// empty tiles and pairs that could merge, penalties for large tiles and
+// for rows that aren't monotonic. The weights come from a parameter search.
+static float row_heuristic[ROWS];
+// A lost board's value: rows out of order score far below zero, so it is
+// twice the least any board could score, and below every leaf.
+static float loss_value;
+
+static void init_solver_tables(void) {
+  float least = 0;
+  for(u32 r = 0; r < ROWS; ++r) {
+    u8 row[TILES_PER_DIM];
+    FOR(j, 0, TILES_PER_DIM) row[j] = (r >> (4 * j)) & 0xf;
+    float sum = 0, left = 0, right = 0;
+    i8 empty = 0, merges = 0, run = 0;
+    u8 prev = 0;
+    FOR(j, 0, TILES_PER_DIM) {
+      sum += powf(row[j], 3.5f);
+      if(row[j] == 0) {
+        empty += 1;
+        continue;
+      }
+      if(row[j] == prev) {
+        run += 1;
+      } else {
+        if(run > 0) merges += 1 + run;
+        run = 0;
+      }
+      prev = row[j];
+    }
+    if(run > 0) merges += 1 + run;
+    FOR(j, 1, TILES_PER_DIM) {
+      float a = powf(row[j-1], 4), b = powf(row[j], 4);
+      if(row[j-1] > row[j]) left  += a - b;
+      else                  right += b - a;
+    }
+    row_heuristic[r] = 200000.0f + 270.0f * empty + 700.0f * merges
+                     - 47.0f * fminf(left, right) - 11.0f * sum;
+    least = fminf(least, row_heuristic[r]);
   }
-  move_nonzero_first(row);
+  loss_value = 2 * (2 * TILES_PER_DIM * least) - 1;
 }
 
-static void merge_left(struct board* b) {
+static float heuristic(u64 p) {
+  u64   t = g2048_bb_transpose(p);
+  float h = 0;
   FOR(i, 0, TILES_PER_DIM)
-    merge_row_left(b->tiles[i]);
+    h += row_heuristic[g2048_bb_row(p, i)] + row_heuristic[g2048_bb_row(t, i)];
+  return h;
 }
 
-static bool is_victory(const struct board* b) {
-  bool r = false;
-  FOR_TILES(i, j) r |= b->tiles[i][j] >= TARGET_TILE;
-  return r;
+#if TILES_PER_DIM == 4
+// The endgame tablebase holds exact odds for positions with a wall: two
+// full rows of tiles of at least 2^TB_TILE along one side, no two equal
+// next to each other, and the other two rows, the region, all below it.
+// Moving along the wall or towards it leaves the wall as it is, so
+// the region plays a little game of its own: build a 2^TB_TILE before it is
+// stuck with only the move away from the wall. tb_odds[i] is the chance of
+// that under the best play, for the region with index i. There are
+// TB_TILE^8 regions. The region's tile sum only grows, by a new tile after
+// each move, so the odds come from regions of higher sums, which are solved
+// first. The file is a header and TB_BLOCK odds to a block, as u16 fixed
+// point. A block of equal odds is stored as just the one. Any other block is
+// a mask of which of its odds are certain, a mask of which are hopeless, and
+// the rest in order; a third of all odds are certain and a ninth hopeless,
+// so the file is about 30% smaller than the odds.
+#define TB_TILE    7
+#define TB_REGIONS 5764801u  // TB_TILE^8
+#define TB_BLOCK   64
+#define TB_BLOCKS  ((TB_REGIONS + TB_BLOCK - 1) / TB_BLOCK)
+#define TB_VERSION 2
+// uniform blocks have this bit set in their entry, and their odds below it;
+// the others have the u16 offset of their masks
+#define TB_UNIFORM 0x80000000u
+#define TB_CERTAIN 65535
+// a wall to solve against, above the region: distinct tiles of 2^8 and up
+#define TB_WALL    0xba98cdefull
+// what the solver's leaves add to the heuristic for certain odds
+#define TB_BONUS   20000.0f
+
+struct tb_header {
+  char magic[8];
+  u32  version;
+  u32  tile;
+  u32  blocks;
+  u32  reserved;
+};
+
+// the mapped file: blocks[b] is either uniform or an offset into odds, of
+// its masks, four u16s each, and then the odds neither covers
+struct tablebase {
+  const u32* blocks;
+  const u16* odds;
+  void*      map;
+  size_t     len;
+};
+
+static struct tablebase tablebase;
+
+static u32 tb_index(u32 region) {
+  u32 i = 0;
+  FOR(k, 0, 8) i = i * TB_TILE + (region >> (4 * (7 - k)) & 0xf);
+  return i;
 }
 
-static bool is_loss(const struct board* b) {
-  bool no_moves = true;
-  struct board rotated = *b;
-  FOR(i, 0, 4) {
-    struct board merged = rotated;
-    merge_left(&merged);
-    no_moves &= EQ(&rotated, &merged);
-    rotate_cw(&rotated);
+static u32 tb_region(u32 i) {
+  u32 region = 0;
+  FOR(k, 0, 8) {
+    region |= (i % TB_TILE) << (4 * k);
+    i /= TB_TILE;
   }
-  return no_moves;
+  return region;
 }
 
-static i8 cw_rotations_of_key(int key) {
-  switch(key) {
-  case KEY_LEFT:  return 0;
-  case KEY_DOWN:  return 1;
-  case KEY_RIGHT: return 2;
-  case KEY_UP:    return 3;
-  default:        return -1;
+static u32 tb_sum(u32 region) {
+  u32 sum = 0;
+  FOR(k, 0, 8) {
+    u8 v = region >> (4 * k) & 0xf;
+    sum += v == 0 ? 0 : 1u << v;
   }
+  return sum;
+}
+
+// the number of tiles of [p] of at least 2^c: each nibble, in a byte of its
+// own, carries into bit 4 when 16 - c is added
+static i8 bb_count_at_least(u64 p, u8 c) {
+  u64 add = (16 - c) * 0x0101010101010101ull;
+  u64 lo  = ((p      & 0x0f0f0f0f0f0f0f0full) + add) & 0x1010101010101010ull;
+  u64 hi  = ((p >> 4 & 0x0f0f0f0f0f0f0f0full) + add) & 0x1010101010101010ull;
+  return __builtin_popcountll(lo) + __builtin_popcountll(hi);
 }
 
-static u32 new_points(const struct board* b0, const struct board* b1) {
-  // dcount = # old tiles - # new tiles
-  i8 dcount[TARGET_TILE+1] = {0};
-  FOR_TILES(i, j) dcount[b0->tiles[i][j]] += 1;
-  FOR_TILES(i, j) dcount[b1->tiles[i][j]] -= 1;
-  u32 score = 0;
-  FOR(i, 1, TARGET_TILE) {
-    i8 upgrades = dcount[i] / 2;
-    if(upgrades <= 0) continue;
-    score += (u32)upgrades << (u32)(i+1);
-    dcount[i+1] += upgrades;
+// the best move of a board with the wall in rows 0 and 1, reading the odds
+// of the regions it can reach from [odds]; -1 when stuck
+static i8 tb_move(u64 p, float (*odds)(u32 i), float* best) {
+  i8 dir = -1;
+  *best = 0;
+  static const i8 moves[] = { LEFT, RIGHT, UP };
+  FOR(k, 0, 3) {
+    u64 moved = g2048_bb_merge(p, moves[k]);
+    if(moved == p) continue;
+    float value = 1;
+    if(bb_count_at_least(moved >> 32, TB_TILE) == 0) {
+      u64 empty = g2048_bb_empty(moved);
+      float sum = 0;
+      for(u64 m = empty; m != 0; m &= m - 1) {
+        u64 two = m & -m;
+        sum += 0.9f * odds(tb_index((moved | two)      >> 32));
+        sum += 0.1f * odds(tb_index((moved | two << 1) >> 32));
+      }
+      value = sum / __builtin_popcountll(empty);
+    }
+    if(dir < 0 || value > *best) {
+      dir   = moves[k];
+      *best = value;
+    }
   }
-  return score;
+  return dir;
 }
 
-static void update(struct game* g, int key) {
-  i8 rotations = cw_rotations_of_key(key);
-  if(rotations < 0) return;
+static float* tb_solving;
 
-  struct board* board = &g->board;
-  struct board  b0    = *board;
+static float solving_odds(u32 i) { return tb_solving[i]; }
 
-  FOR(i, 0, 4) {
-    if(i == rotations) merge_left(board);
-    rotate_cw(board);
+static void build_tablebase(const char* path) {
+  // regions by their tile sum, highest first
+  u32  sums = 8u << (TB_TILE - 1);
+  u32* start = calloc(sums / 2 + 2, sizeof(u32));
+  u32* order = malloc(TB_REGIONS * sizeof(u32));
+  for(u32 i = 0; i < TB_REGIONS; ++i)
+    start[(sums - tb_sum(tb_region(i))) / 2 + 1] += 1;
+  for(u32 s = 1; s <= sums / 2 + 1; ++s) start[s] += start[s - 1];
+  for(u32 i = 0; i < TB_REGIONS; ++i)
+    order[start[(sums - tb_sum(tb_region(i))) / 2]++] = i;
+  tb_solving = malloc(TB_REGIONS * sizeof(float));
+  for(u32 k = 0; k < TB_REGIONS; ++k) {
+    u32   i = order[k];
+    float best;
+    tb_move(TB_WALL | (u64)tb_region(i) << 32, solving_odds, &best);
+    tb_solving[i] = best;
   }
 
-  g->score += new_points(&b0, board);
+  FILE* f = open_or_die(path, "wb");
+  struct tb_header h =
+    { .magic   = { '2', '0', '4', '8', 't', 'b', 0, 0 }
+    , .version = TB_VERSION
+    , .tile    = TB_TILE
+    , .blocks  = TB_BLOCKS
+    };
+  u32* blocks = malloc(TB_BLOCKS * sizeof(u32));
+  u16* odds   = malloc(TB_BLOCKS * (TB_BLOCK + 8) * sizeof(u16));
+  u32  n      = 0, stored = 0;
+  for(u32 b = 0; b < TB_BLOCKS; ++b) {
+    u32  first   = b * TB_BLOCK;
+    u32  last    = first + TB_BLOCK < TB_REGIONS ? first + TB_BLOCK
+                                                 : TB_REGIONS;
+    u16  q[TB_BLOCK] = { 0 };
+    bool uniform = true;
+    for(u32 i = first; i < last; ++i) {
+      q[i - first] = lrintf(tb_solving[i] * 65535);
+      uniform &= q[i - first] == q[0];
+    }
+    if(uniform) {
+      blocks[b] = TB_UNIFORM | q[0];
+      continue;
+    }
+    u64 masks[2] = { 0, 0 };
+    blocks[b] = n;
+    stored   += 1;
+    n        += 8;
+    for(u32 i = 0; i < last - first; ++i) {
+      if(q[i] == TB_CERTAIN) masks[0] |= 1ull << i;
+      else if(q[i] == 0)     masks[1] |= 1ull << i;
+      else                   odds[n++] = q[i];
+    }
+    memcpy(odds + blocks[b], masks, sizeof(masks));
+  }
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(blocks, sizeof(u32), TB_BLOCKS, f);
+  fwrite(odds, sizeof(u16), n, f);
+  fclose(f);
+  printf("%u regions, %u of %u blocks stored, %zu bytes\n", TB_REGIONS,
+    stored, TB_BLOCKS, sizeof(h) + TB_BLOCKS * sizeof(u32) + n * sizeof(u16));
+  free(blocks);
+  free(odds);
+  free(tb_solving);
+  free(order);
+  free(start);
+}
 
-  if(!EQ(board, &b0))
-    new_tile(board, &g->seed);
+static void load_tablebase(const char* path) {
+  size_t len;
+  void*  map = map_file(path, sizeof(struct tb_header), &len);
+  const struct tb_header* h = map;
+  if(map == MAP_FAILED || memcmp(h->magic, "2048tb", 6) != 0
+  || h->version != TB_VERSION || h->tile != TB_TILE
+  || h->blocks != TB_BLOCKS
+  || len < sizeof(*h) + TB_BLOCKS * sizeof(u32)) {
+    fprintf(stderr, "%s: not a tablebase\n", path);
+    exit(1);
+  }
+  tablebase.map    = map;
+  tablebase.len    = len;
+  tablebase.blocks = (const u32*)(h + 1);
+  tablebase.odds   = (const u16*)(tablebase.blocks + TB_BLOCKS);
 }
 
-static void sigint(int _) {
-  endwin();
-  exit(0);
+static float mapped_odds(u32 i) {
+  u32 b = tablebase.blocks[i / TB_BLOCK];
+  if(b & TB_UNIFORM) return (b & 0xffff) / 65535.0f;
+  u64 masks[2], bit = 1ull << i % TB_BLOCK;
+  memcpy(masks, tablebase.odds + b, sizeof(masks));
+  if(masks[0] & bit) return 1;
+  if(masks[1] & bit) return 0;
+  u32 rank = __builtin_popcountll(~(masks[0] | masks[1]) & (bit - 1));
+  return tablebase.odds[b + 8 + rank] / 65535.0f;
 }
 
-int main(void) {
-  struct sigaction act;
-  act.sa_handler = sigint;
-  sigaction(SIGINT, &act, NULL);
-  initscr();
-  curs_set(0);
-  cbreak();
-  noecho();
-  keypad(stdscr, true);
-  struct game g =
-    { .board = { .tiles = {{0}} }
-    , .score = 0
-    , .seed  = time(NULL)
+// true if the image of [p] under t has the wall in rows 0 and 1, for some
+// transform t without a mirror, since mirrored regions have the same odds
+static bool tb_find(u64 p, u64* image, i8* t) {
+  if(tablebase.map == NULL || bb_count_at_least(p, TB_TILE) != 8) return false;
+  for(*t = 0; *t < 8; *t += 2) {
+    u64 q = *t & 4 ? g2048_bb_transpose(p) : p;
+    if(*t & 2) q = g2048_bb_flip(q);
+    u32 wall = q;
+    if(bb_count_at_least(wall, TB_TILE) != 8) continue;
+    // no tile equal to the one after it in a row, or to the one below it
+    u32 same = wall ^ wall >> 4, below = wall ^ wall >> 16;
+    bool ok = true;
+    FOR(j, 0, 3) ok &= (same >> (4 * j) & 0xf) && (same >> (16 + 4 * j) & 0xf);
+    FOR(j, 0, 4) ok &= (below >> (4 * j) & 0xf) != 0;
+    if(ok) {
+      *image = q;
+      return true;
+    }
+  }
+  return false;
+}
+
+// the odds of building the next tile in [p]'s region, or -1 if it has none
+static float tb_odds(u64 p) {
+  u64 q;
+  i8  t;
+  if(!tb_find(p, &q, &t)) return -1;
+  return mapped_odds(tb_index(q >> 32));
+}
+
+// the tablebase's move for [p], when it has one with any odds, or -1
+static i8 tb_best_move(u64 p) {
+  u64   q;
+  i8    t;
+  float odds;
+  if(!tb_find(p, &q, &t)) return -1;
+  i8 dir = tb_move(q, mapped_odds, &odds);
+  return dir < 0 || odds == 0 ? -1 : g2048_untransform_dir(t, dir);
+}
+#endif
+
+// the heuristic, and TB_BONUS for each chance in the tablebase of building
+// the next tile
+static float leaf_value(u64 p) {
+  float h = heuristic(p);
+#if TILES_PER_DIM == 4
+  if(tablebase.map == NULL) return h;
+  float odds = tb_odds(p);
+  if(odds > 0) h += TB_BONUS * odds;
+#endif
+  return h;
+}
+
+// The transposition table remembers chance nodes by their packed board. An
+// entry searched at least as deep as asked for stands in for the search.
+// Every thread searching for a solver shares its table without locks: an
+// entry stores its board xor'd with its data, so an entry torn by two racing
+// writers fails the check and reads as a miss.
+struct tt_entry {
+  u64 check;
+  u64 data;
+};
+
+static u64 tt_data(float value, i8 depth) {
+  u32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return (u64)bits << 32 | (u8)depth;
+}
+
+// A search is one thread's view of the move being searched. [stop] is shared
+// by all of them, and set once any passes the deadline.
+struct search {
+  struct tt_entry* tt;
+  double           deadline;
+  bool*            stop;
+  u32              nodes;
+};
+
+static bool stopped(struct search* se) {
+  if(se->deadline == 0) return false;
+  if(++se->nodes % 4096 == 0 && now() > se->deadline)
+    __atomic_store_n(se->stop, true, __ATOMIC_RELAXED);
+  return __atomic_load_n(se->stop, __ATOMIC_RELAXED);
+}
+
+static float chance_node(struct search* se, u64 p, i8 depth, float cprob);
+
+// loss_value when there is no move
+static float max_node(struct search* se, u64 p, i8 depth, float cprob) {
+  float best = loss_value;
+  u8    legal = g2048_bb_legal_moves(p);
+  FOR(dir, 0, 4)
+    if(legal >> dir & 1)
+      best = fmaxf(best, chance_node(se, g2048_bb_merge(p, dir), depth, cprob));
+  return best;
+}
+
+static float chance_node(struct search* se, u64 p, i8 depth, float cprob) {
+  if(depth <= 0 || cprob < CPROB_MIN) return leaf_value(p);
+  if(stopped(se)) return 0;
+
+  // symmetric boards share an entry; any image is a valid key, so boards
+  // a ply from the leaves, too cheap to be worth canonicalizing, use their own
+  i8  t;
+  u64 key = depth >= 2 ? g2048_bb_canonical(p, &t) : p;
+  struct tt_entry* e = &se->tt[(key * 0x9e3779b97f4a7c15ull) >> (64 - TT_BITS)];
+  u64 data  = __atomic_load_n(&e->data,  __ATOMIC_RELAXED);
+  u64 check = __atomic_load_n(&e->check, __ATOMIC_RELAXED);
+  if((check ^ data) == key && (i8)data >= depth) {
+    u32   bits  = data >> 32;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  u64 empty = g2048_bb_empty(p);
+  i8  n     = g2048_bb_count_zeros(p);
+  float sum = 0;
+  // the same 90% twos and 10% fours as new_tile
+  for(u64 m = empty; m != 0; m &= m - 1) {
+    u64 two = m & -m;
+    sum += 0.9f * max_node(se, p | two,      depth - 1, cprob * 0.9f / n);
+    sum += 0.1f * max_node(se, p | two << 1, depth - 1, cprob * 0.1f / n);
+  }
+  float value = sum / n;
+  if(stopped(se)) return 0;
+  data = tt_data(value, depth);
+  __atomic_store_n(&e->check, key ^ data, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->data,  data,     __ATOMIC_RELAXED);
+  return value;
+}
+
+// A fixed depth of 0 picks one per move by search_depth. With a time budget,
+// the solver instead deepens one ply at a time until the budget runs out,
+// and plays the best move of the deepest search it finished.
+struct search_options {
+  int    threads;
+  i8     depth;
+  double think;
+};
+
+static struct search_options search_options = { .threads = 1 };
+
+// The root is split into one task per move and new tile, in the order
+// new_tile counts the empty cells, and the tasks are shared out between the
+// calling thread and the solver's pool.
+struct task {
+  u64   board;
+  i8    dir;
+  float prob;
+  float value;
+};
+
+struct solver {
+  struct arena          arena;  // holds the table
+  struct tt_entry*      tt;
+  struct search_options opt;
+
+  pthread_t*      pool;
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;
+  pthread_cond_t  done;
+  u64             generation;
+  int             busy;
+  bool            quit;
+
+  struct task tasks[4 * TILES_PER_DIM * TILES_PER_DIM * 2];
+  u32         ntasks;
+  u32         next;
+  i8          depth;
+  double      deadline;
+  bool        stop;
+};
+
+static void run_tasks(struct solver* s, i8 depth, double deadline) {
+  struct search se =
+    { .tt = s->tt, .deadline = deadline, .stop = &s->stop, .nodes = 0 };
+  for(;;) {
+    u32 i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+    if(i >= s->ntasks) return;
+    struct task* t = &s->tasks[i];
+    t->value = max_node(&se, t->board, depth - 1, t->prob);
+  }
+}
+
+// Tasks, [next] and the search parameters only change while the lock is held
+// and no thread is busy, so a thread always runs the tasks it woke up for.
+static void* solver_thread(void* arg) {
+  struct solver* s = arg;
+  u64 seen = 0;
+  pthread_mutex_lock(&s->lock);
+  for(;;) {
+    while(!s->quit && s->generation == seen)
+      pthread_cond_wait(&s->wake, &s->lock);
+    if(s->quit) break;
+    seen = s->generation;
+    i8     depth    = s->depth;
+    double deadline = s->deadline;
+    s->busy += 1;
+    pthread_mutex_unlock(&s->lock);
+    run_tasks(s, depth, deadline);
+    pthread_mutex_lock(&s->lock);
+    if(--s->busy == 0) pthread_cond_signal(&s->done);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+static struct solver* new_solver(const struct search_options* opt) {
+  struct solver* s = calloc(1, sizeof(struct solver));
+  size_t tt_size   = ((size_t)1 << TT_BITS) * sizeof(struct tt_entry);
+  s->arena = new_arena(tt_size);
+  s->tt    = arena_alloc(&s->arena, tt_size);
+  s->opt = *opt;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->wake, NULL);
+  pthread_cond_init(&s->done, NULL);
+  s->pool = calloc(opt->threads, sizeof(pthread_t));
+  for(int i = 1; i < opt->threads; ++i)
+    pthread_create(&s->pool[i], NULL, solver_thread, s);
+  return s;
+}
+
+static void free_solver(struct solver* s) {
+  if(s == NULL) return;
+  pthread_mutex_lock(&s->lock);
+  s->quit = true;
+  pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+  for(int i = 1; i < s->opt.threads; ++i) pthread_join(s->pool[i], NULL);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->wake);
+  pthread_cond_destroy(&s->done);
+  free(s->pool);
+  free_arena(&s->arena);
+  free(s);
+}
+
+// Searches every move from [p] to [depth] and fills in [values] for the
+// ones in g2048_bb_legal_moves(p). False if the deadline passed first.
+static bool search_root(struct solver* s, u64 p, i8 depth, double deadline,
+                        float values[4]) {
+  pthread_mutex_lock(&s->lock);
+  while(s->busy > 0) pthread_cond_wait(&s->done, &s->lock);
+  s->ntasks = 0;
+  u8 legal = g2048_bb_legal_moves(p);
+  FOR(dir, 0, 4) {
+    values[dir] = 0;
+    if(!(legal >> dir & 1)) continue;
+    u64 moved = g2048_bb_merge(p, dir);
+    u64 empty = g2048_bb_empty(moved);
+    i8  n     = g2048_bb_count_zeros(moved);
+    for(u64 m = empty; m != 0; m &= m - 1) {
+      u64 two = m & -m;
+      s->tasks[s->ntasks++] = (struct task){ moved | two,      dir, 0.9f / n };
+      s->tasks[s->ntasks++] = (struct task){ moved | two << 1, dir, 0.1f / n };
+    }
+  }
+  s->next       = 0;
+  s->depth      = depth;
+  s->deadline   = deadline;
+  s->stop       = false;
+  s->generation += 1;
+  pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+
+  run_tasks(s, depth, deadline);
+
+  pthread_mutex_lock(&s->lock);
+  while(s->busy > 0) pthread_cond_wait(&s->done, &s->lock);
+  for(u32 i = 0; i < s->ntasks; ++i)
+    values[s->tasks[i].dir] += s->tasks[i].prob * s->tasks[i].value;
+  bool finished = !s->stop;
+  pthread_mutex_unlock(&s->lock);
+  return finished;
+}
+
+// Searches deeper as the board fills with more kinds of tile.
+static i8 search_depth(u64 p) {
+  u32 kinds = 0;
+  FOR(k, 0, TILES_PER_DIM * TILES_PER_DIM) kinds |= 1u << (p >> (4 * k) & 0xf);
+  i8 depth = __builtin_popcount(kinds >> 1) - 5;
+  return depth < 2 ? 2 : depth;
+}
+
+static i8 best_of(const float values[4], u8 legal) {
+  i8 best = -1;
+  FOR(dir, 0, 4)
+    if(legal >> dir & 1 && (best < 0 || values[dir] > values[best]))
+      best = dir;
+  return best;
+}
+
+// -1 if no move changes the board
+static i8 search_best(struct solver* s, u64 p) {
+  float values[4];
+  u8    legal = g2048_bb_legal_moves(p);
+  if(s->opt.think <= 0) {
+    i8 depth = s->opt.depth > 0 ? s->opt.depth : search_depth(p);
+    search_root(s, p, depth, 0, values);
+    return best_of(values, legal);
+  }
+  // the first ply always finishes, so there is always a move
+  double deadline = now() + s->opt.think;
+  search_root(s, p, 1, 0, values);
+  i8 best = best_of(values, legal);
+  for(i8 depth = 2; depth < 64 && now() < deadline; ++depth) {
+    if(!search_root(s, p, depth, deadline, values)) break;
+    best = best_of(values, legal);
+  }
+  return best;
+}
+
+// the tablebase's move, if it has one; otherwise searches the canonical
+// image of [p], and turns its move back
+static i8 best_move(struct solver* s, u64 p) {
+  i8 t;
+#if TILES_PER_DIM == 4
+  i8 dir = tb_best_move(p);
+  if(dir >= 0) return dir;
+#endif
+  i8 best = search_best(s, g2048_bb_canonical(p, &t));
+  return best < 0 ? best : g2048_untransform_dir(t, best);
+}
+
+#endif
+
+// A policy picks the direction to move a game in, or -1 if no move changes
+// the board. A player holds what one thread needs to run any policy: an rng
+// of its own, so it doesn't disturb new_tile, and a solver, made on first use.
+struct player {
+  struct g2048_rng rng;
+  struct solver*   solver;
+};
+
+struct policy {
+  const char* name;
+  i8 (*choose)(const struct g2048_game* g, struct player* pl);
+};
+
+// the points moving [b] would score
+static u32 points_of(const struct g2048_board* b, i8 dir) {
+  struct g2048_board m = *b;
+  return g2048_move(&m, dir);
+}
+
+static i8 random_policy(const struct g2048_game* g, struct player* pl) {
+  u8 legal = g2048_legal_moves(&g->board);
+  if(legal == 0) return -1;
+  i8 k = g2048_rng_below(&pl->rng, __builtin_popcount(legal));
+  FOR(i, 0, k) legal &= legal - 1;
+  return __builtin_ctz(legal);
+}
+
+// the move scoring the most points right now, ties broken at random
+static i8 greedy_policy(const struct g2048_game* g, struct player* pl) {
+  u8  legal = g2048_legal_moves(&g->board);
+  i8  best = -1, ties = 0;
+  u32 best_points = 0;
+  FOR(dir, 0, 4) {
+    if(!(legal >> dir & 1)) continue;
+    u32 points = points_of(&g->board, dir);
+    if(best < 0 || points > best_points) {
+      best        = dir;
+      best_points = points;
+      ties        = 1;
+    } else if(points == best_points && g2048_rng_below(&pl->rng, ++ties) == 0) {
+      best = dir;
+    }
+  }
+  return best;
+}
+
+#if TILES_PER_DIM == 4
+// The n-tuple network values a board after a move, before its new tile, by
+// summing a weight for each of NT_TUPLES six-cell tuples under each of the
+// 8 symmetries, looked up by the tuple's six nibbles. Tuples 0 and 1 are
+// six cells in a row, from the corner and from the second row; tuples 2 and
+// 3 are 2x3 blocks at the same places. Each tuple's 16^6 weights are one
+// contiguous table, from the page after the header, and all 32 indices are
+// worked out before any lookup, so the cache misses overlap.
+#define NT_TUPLES  4
+#define NT_ENTRIES (1u << 24)
+#define NT_DATA    4096
+#define NT_VERSION 1
+
+struct nt_header {
+  char magic[8];
+  u32  version;
+  u32  tuples;
+  u32  entries;
+  u32  reserved;
+};
+
+// The weights, mapped from their file: --ntuple maps them to play, --train
+// to learn them in place, at rate alpha with trace decay lambda.
+struct ntuple {
+  float* w;
+  bool   train;
+  float  alpha;
+  float  lambda;
+};
+
+static struct ntuple ntuple = { .alpha = 0.1f, .lambda = 0 };
+
+static void map_ntuple(const char* path, bool train) {
+  size_t len = NT_DATA + (size_t)NT_TUPLES * NT_ENTRIES * sizeof(float);
+  int fd = open(path, train ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    exit(1);
+  }
+  struct nt_header h =
+    { .magic   = { '2', '0', '4', '8', 'n', 't', 'u', 'p' }
+    , .version = NT_VERSION
+    , .tuples  = NT_TUPLES
+    , .entries = NT_ENTRIES
     };
-  FOR(i, 0, INITIAL_TILES) new_tile(&g.board, &g.seed);
-  while(!is_victory(&g.board) && !is_loss(&g.board)) {
-    draw(&g);
+  // a new file starts all zeros, and stays sparse until trained
+  if(train && st.st_size == 0
+  && (pwrite(fd, &h, sizeof(h), 0) != sizeof(h) || ftruncate(fd, len) < 0)) {
+    perror(path);
+    exit(1);
+  }
+  void* map = MAP_FAILED;
+  if(train || (size_t)st.st_size == len)
+    map = mmap(NULL, len, train ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED || memcmp(map, &h, sizeof(h)) != 0) {
+    fprintf(stderr, "%s: not an n-tuple network\n", path);
+    exit(1);
+  }
+  ntuple.w     = (float*)((char*)map + NT_DATA);
+  ntuple.train = train;
+}
+
+static u32 nt_index(u64 p, i8 k) {
+  u64 r = p >> (16 * (k & 1));
+  return k < 2 ? r & 0xffffff : (r & 0xfff) | (r >> 4 & 0xfff000);
+}
+
+// the index of each tuple in each image of [p], tuple by tuple
+static void nt_indices(u64 p, u32* out) {
+  u64 q = g2048_bb_transpose(p);
+  u64 m = g2048_bb_mirror(p), n = g2048_bb_mirror(q);
+  u64 images[8] = { p, m, g2048_bb_flip(p), g2048_bb_flip(m),
+                    q, n, g2048_bb_flip(q), g2048_bb_flip(n) };
+  FOR(k, 0, NT_TUPLES) FOR(t, 0, 8)
+    out[8 * k + t] = k * NT_ENTRIES + nt_index(images[t], k);
+}
+
+static float nt_value(u64 p) {
+  u32   idx[8 * NT_TUPLES];
+  float v = 0;
+  nt_indices(p, idx);
+  FOR(i, 0, 8 * NT_TUPLES) v += ntuple.w[idx[i]];
+  return v;
+}
+
+static i8 ntuple_policy(const struct g2048_game* g, struct player* pl) {
+  u64   p     = g2048_pack_board(&g->board);
+  u8    legal = g2048_bb_legal_moves(p);
+  i8    best  = -1;
+  float best_value = 0;
+  FOR(dir, 0, 4) {
+    if(!(legal >> dir & 1)) continue;
+    u32   points = 0;
+    u64   after  = g2048_bb_move(p, dir, &points);
+    float value  = points + nt_value(after);
+    if(best < 0 || value > best_value) {
+      best       = dir;
+      best_value = value;
+    }
+  }
+  return best;
+}
+
+// The boards a game left after each of its moves, and the points each move
+// scored, for training once it is over.
+struct trail {
+  u64* after;
+  u32* points;
+  u32  n;
+  u32  cap;
+};
+
+static void trail_add(struct trail* tr, const struct g2048_game* g, i8 dir) {
+  if(tr->n == tr->cap) {
+    tr->cap    = tr->cap ? 2 * tr->cap : 1024;
+    tr->after  = realloc(tr->after,  tr->cap * sizeof(u64));
+    tr->points = realloc(tr->points, tr->cap * sizeof(u32));
+  }
+  tr->points[tr->n] = 0;
+  tr->after [tr->n] =
+    g2048_bb_move(g2048_pack_board(&g->board), dir, &tr->points[tr->n]);
+  tr->n += 1;
+}
+
+// TD(lambda) on the afterstates, from the last back: each moves towards the
+// lambda-return, the next move's points plus a mix of the next afterstate's
+// value and its return. The last afterstate led to a loss, and is worth 0.
+// Threads training the same weights race on them; an update lost now and
+// then doesn't matter.
+static void nt_train(const struct trail* tr) {
+  float ret = 0;
+  float rate = ntuple.alpha / (8 * NT_TUPLES);
+  for(u32 i = tr->n; i-- > 0;) {
+    u32   idx[8 * NT_TUPLES];
+    float v = 0;
+    nt_indices(tr->after[i], idx);
+    FOR(k, 0, 8 * NT_TUPLES) v += ntuple.w[idx[k]];
+    float step = rate * (ret - v);
+    FOR(k, 0, 8 * NT_TUPLES) ntuple.w[idx[k]] += step;
+    if(i > 0)
+      ret = tr->points[i] + (1 - ntuple.lambda) * (v + 8 * NT_TUPLES * step)
+                          + ntuple.lambda * ret;
+  }
+}
+#endif
+
+#ifdef PACKED
+static i8 expectimax_policy(const struct g2048_game* g, struct player* pl) {
+  if(pl->solver == NULL) pl->solver = new_solver(&search_options);
+  return best_move(pl->solver, g2048_pack_board(&g->board));
+}
+#endif
+
+static const struct policy policies[] =
+  { { "random",     random_policy     }
+  , { "greedy",     greedy_policy     }
+#ifdef PACKED
+  , { "expectimax", expectimax_policy }
+#endif
+#if TILES_PER_DIM == 4
+  , { "ntuple",     ntuple_policy     }
+#endif
+  };
+
+#define POLICIES (sizeof(policies) / sizeof(policies[0]))
+
+// the policy called [name], or NULL
+static const struct policy* policy_named(const char* name) {
+  FOR(k, 0, POLICIES)
+    if(strcmp(name, policies[k].name) == 0) return &policies[k];
+  return NULL;
+}
+
+// A replay is all it takes to play a game again: its seed, and each move that
+// changed the board, two bits apiece, four to a byte from the low bits up.
+// The final score is kept to check the game against. A file holds any number
+// of replays back to back, in host byte order, each after a 32-byte header
+// whose every byte is a field, with no padding.
+#define REPLAY_VERSION 2
+
+struct replay_header {
+  char magic[4];
+  u8   version;
+  u8   dim;
+  u8   initial;
+  u8   reserved;
+  u32  moves;
+  u32  reserved2;
+  u64  score;
+  u64  seed;
+};
+
+struct replay {
+  u64 seed;
+  u64 score;
+  u32 moves;
+  u32 cap;
+  u8* bytes;
+};
+
+static void replay_add(struct replay* r, i8 dir) {
+  if(r->moves / 4 >= r->cap) {
+    r->cap   = r->cap == 0 ? 256 : 2 * r->cap;
+    r->bytes = realloc(r->bytes, r->cap);
+  }
+  if(r->moves % 4 == 0) r->bytes[r->moves / 4] = 0;
+  r->bytes[r->moves / 4] |= dir << (2 * (r->moves % 4));
+  r->moves += 1;
+}
+
+// takes back the last move added, for undo
+static void replay_pop(struct replay* r) {
+  r->moves -= 1;
+  r->bytes[r->moves / 4] &= ~(3 << (2 * (r->moves % 4)));
+}
+
+static i8 replay_move(const struct replay* r, u32 i) {
+  return r->bytes[i / 4] >> (2 * (i % 4)) & 3;
+}
+
+static void write_replay(FILE* f, const struct replay* r) {
+  struct replay_header h =
+    { .magic   = { '2', '0', '4', '8' }
+    , .version = REPLAY_VERSION
+    , .dim     = TILES_PER_DIM
+    , .initial = INITIAL_TILES
+    , .moves   = r->moves
+    , .score   = r->score
+    , .seed    = r->seed
+    };
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(r->bytes, 1, (r->moves + 3) / 4, f);
+}
+
+// false at the end of [f]; exits on anything this build can't play back
+static bool read_replay(FILE* f, struct replay* r) {
+  struct replay_header h;
+  if(fread(&h, sizeof(h), 1, f) != 1) return false;
+  if(memcmp(h.magic, "2048", 4) != 0 || h.version != REPLAY_VERSION
+  || h.dim != TILES_PER_DIM || h.initial != INITIAL_TILES) {
+    fprintf(stderr, "not a replay of this game\n");
+    exit(1);
+  }
+  u32 n = (h.moves + 3) / 4;
+  if(n > r->cap) {
+    r->cap   = n;
+    r->bytes = realloc(r->bytes, r->cap);
+  }
+  if(fread(r->bytes, 1, n, f) != n) {
+    fprintf(stderr, "truncated replay\n");
+    exit(1);
+  }
+  r->seed  = h.seed;
+  r->score = h.score;
+  r->moves = h.moves;
+  return true;
+}
+
+// A dataset is a header and then one fixed-size sample per move of every
+// game, in host byte order, for training move evaluators. Files only grow:
+// each finished game is appended whole, so a reader never sees half of one.
+#define DATASET_VERSION 1
+
+struct dataset_header {
+  char magic[8];
+  u32  version;
+  u32  sample_size;
+};
+
+struct sample {
+  u64 board;        // packed, before the move
+  u32 points;       // scored by the move
+  u32 final_score;  // of the game
+  u32 turn;         // moves made before this one
+  u8  move;
+  u8  final_max;    // log_2 of the game's largest tile
+  u16 reserved;
+};
+
+// one game's samples, before they are written out
+struct samples {
+  struct sample* s;
+  u32 n;
+  u32 cap;
+};
+
+#ifdef PACKED
+// records [dir] from [g]; points holds the score before it, until
+// finish_samples knows the scores after
+static void add_sample(struct samples* out, const struct g2048_game* g,
+                       i8 dir) {
+  if(out->n == out->cap) {
+    out->cap = out->cap == 0 ? 1024 : 2 * out->cap;
+    out->s   = realloc(out->s, out->cap * sizeof(struct sample));
+  }
+  out->s[out->n] = (struct sample)
+    { .board  = g2048_pack_board(&g->board)
+    , .points = g->score
+    , .turn   = out->n
+    , .move   = dir
+    };
+  out->n += 1;
+}
+
+static void finish_samples(struct samples* out, const struct g2048_game* g) {
+  u8 top = g2048_max_tile(&g->board);
+  for(u32 i = 0; i < out->n; ++i) {
+    u32 after = i + 1 < out->n ? out->s[i + 1].points : g->score;
+    out->s[i].points      = after - out->s[i].points;
+    out->s[i].final_score = g->score;
+    out->s[i].final_max   = top;
+  }
+}
+
+static FILE* open_dataset_for_append(const char* path) {
+  FILE* f = open_or_die(path, "ab");
+  fseek(f, 0, SEEK_END);
+  if(ftell(f) == 0) {
+    struct dataset_header h =
+      { .magic       = { '2', '0', '4', '8', 'd', 'a', 't', 'a' }
+      , .version     = DATASET_VERSION
+      , .sample_size = sizeof(struct sample)
+      };
+    fwrite(&h, sizeof(h), 1, f);
+  }
+  return f;
+}
+
+// A dataset mapped read-only: samples[i] is the ith sample, in place.
+struct dataset {
+  const struct sample* samples;
+  u64    n;
+  void*  map;
+  size_t len;
+};
+
+static struct dataset map_dataset(const char* path) {
+  struct dataset d;
+  d.map = map_file(path, sizeof(struct dataset_header), &d.len);
+  const struct dataset_header* h = d.map;
+  if(d.map == MAP_FAILED || memcmp(h->magic, "2048data", 8) != 0
+  || h->version != DATASET_VERSION
+  || h->sample_size != sizeof(struct sample)) {
+    fprintf(stderr, "%s: not a dataset\n", path);
+    exit(1);
+  }
+  d.samples = (const struct sample*)(h + 1);
+  d.n       = (d.len - sizeof(*h)) / sizeof(struct sample);
+  return d;
+}
+
+static void unmap_dataset(struct dataset* d) { munmap(d->map, d->len); }
+#endif
+
+// Simulated games play on past TARGET_TILE until they are lost. Game i is
+// seeded with seed + i, so the results don't depend on which thread, or how
+// many threads, played it.
+// no tile on a board of n cells gets past 2^(n + 1)
+#define MAX_TILE (CELLS + 1)
+
+struct stats {
+  u64 games;
+  u64 moves;
+  u64 max_tiles[MAX_TILE + 1];
+};
+
+// Where a game played goes, besides its stats: a replay, its samples and
+// the trail it trains the n-tuple network on, each unless NULL.
+struct game_log {
+  struct replay*  rec;
+  struct samples* samples;
+#if TILES_PER_DIM == 4
+  struct trail*   trail;
+#endif
+};
+
+static u64 play(const struct policy* pol, u64 seed, struct player* pl,
+                struct stats* st, struct game_log log) {
+  struct g2048_game g = g2048_new_game(seed);
+  pl->rng = g2048_rng_seed(~seed);
+  if(log.rec != NULL) {
+    log.rec->seed  = seed;
+    log.rec->moves = 0;
+  }
+  if(log.samples != NULL) log.samples->n = 0;
+#if TILES_PER_DIM == 4
+  if(log.trail != NULL) log.trail->n = 0;
+#endif
+  for(i8 dir; (dir = pol->choose(&g, pl)) >= 0; ++st->moves) {
+#ifdef PACKED
+    if(log.samples != NULL) add_sample(log.samples, &g, dir);
+#endif
+#if TILES_PER_DIM == 4
+    if(log.trail != NULL) trail_add(log.trail, &g, dir);
+#endif
+    g2048_update(&g, dir);
+    if(log.rec != NULL) replay_add(log.rec, dir);
+  }
+  if(log.rec != NULL) log.rec->score = g.score;
+#ifdef PACKED
+  if(log.samples != NULL) finish_samples(log.samples, &g);
+#endif
+#if TILES_PER_DIM == 4
+  if(log.trail != NULL) nt_train(log.trail);
+#endif
+  st->games += 1;
+  st->max_tiles[g2048_max_tile(&g.board)] += 1;
+  return g.score;
+}
+
+static void add_stats(struct stats* into, const struct stats* from) {
+  into->games += from->games;
+  into->moves += from->moves;
+  FOR(t, 0, MAX_TILE + 1) into->max_tiles[t] += from->max_tiles[t];
+}
+
+// Threads take games off the queue a chunk at a time, and keep their own
+// stats until they are done. Replays go to [record] and samples to [export],
+// if either is set, in whatever order the games finish.
+#define CHUNK 64
+
+struct queue {
+  const struct policy* pol;
+  u64      seed;
+  u64      games;
+  u64      next;
+  u64*     scores;
+  FILE*    record;
+  FILE*    export;
+  bool     batch;
+  pthread_mutex_t lock;
+};
+
+struct worker {
+  pthread_t     thread;
+  struct queue* q;
+  struct stats  st;
+};
+
+// the part of the queue a thread has taken
+struct chunk {
+  u64 next;
+  u64 last;
+};
+
+// false once the queue is empty
+static bool take_game(struct queue* q, struct chunk* c, u64* game) {
+  if(c->next == c->last) {
+    u64 first = __atomic_fetch_add(&q->next, CHUNK, __ATOMIC_RELAXED);
+    if(first >= q->games) return false;
+    c->next = first;
+    c->last = first + CHUNK < q->games ? first + CHUNK : q->games;
+  }
+  *game = c->next++;
+  return true;
+}
+
+#ifdef PACKED
+// With --batch, a thread plays BATCH_LANES games at once: the policy picks
+// every lane's move, then one step_batch makes them all. A lane whose game
+// is lost takes the next one off the queue.
+#define BATCH_LANES 256
+
+struct lane {
+  bool             used;
+  u64              game;
+  struct g2048_rng rng;  // the player's
+};
+
+static bool start_lane(struct queue* q, struct chunk* c,
+                       struct batch* b, u32 l, struct lane* ln) {
+  ln->used = take_game(q, c, &ln->game);
+  if(!ln->used) return false;
+  struct g2048_game g = g2048_new_game(q->seed + ln->game);
+  set_lane(b, l, &g);
+  ln->rng = g2048_rng_seed(~(q->seed + ln->game));
+  return true;
+}
+
+static void batch_worker(struct worker* w, struct player* pl) {
+  struct queue* q    = w->q;
+  struct batch  b    = new_batch(BATCH_LANES);
+  struct lane   lanes[BATCH_LANES];
+  struct chunk  c    = { 0, 0 };
+  u32           live = 0;
+  for(u32 l = 0; l < BATCH_LANES; ++l)
+    live += start_lane(q, &c, &b, l, &lanes[l]);
+  while(live > 0) {
+    for(u32 l = 0; l < BATCH_LANES; ++l) {
+      struct lane* ln = &lanes[l];
+      if(!ln->used) continue;
+      struct g2048_game g = lane_game(&b, l);
+      if(b.lost[l]) {
+        w->st.games += 1;
+        w->st.max_tiles[g2048_max_tile(&g.board)] += 1;
+        q->scores[ln->game] = g.score;
+        if(!start_lane(q, &c, &b, l, ln)) {
+          b.moves[l] = -1;
+          live -= 1;
+          continue;
+        }
+        g = lane_game(&b, l);
+      }
+      pl->rng = ln->rng;
+      b.moves[l] = q->pol->choose(&g, pl);
+      ln->rng = pl->rng;
+      if(b.moves[l] < 0) b.lost[l] = 1;
+      else               w->st.moves += 1;
+    }
+    step_batch(&b);
+  }
+  free_batch(&b);
+}
+#endif
+
+static void* simulate_worker(void* arg) {
+  struct worker* w  = arg;
+  struct queue*  q  = w->q;
+  struct player  pl = { .solver = NULL };
+#ifdef PACKED
+  if(q->batch) {
+    batch_worker(w, &pl);
+    free_solver(pl.solver);
+    return NULL;
+  }
+#endif
+  struct replay  rec = { .bytes = NULL };
+  struct samples smp = { .s = NULL };
+#if TILES_PER_DIM == 4
+  struct trail   tr  = { .after = NULL };
+#endif
+  struct game_log log =
+    { .rec     = q->record != NULL ? &rec : NULL
+    , .samples = q->export != NULL ? &smp : NULL
+#if TILES_PER_DIM == 4
+    , .trail   = ntuple.train ? &tr : NULL
+#endif
+    };
+  struct chunk c = { 0, 0 };
+  for(u64 i; take_game(q, &c, &i);) {
+    q->scores[i] = play(q->pol, q->seed + i, &pl, &w->st, log);
+    if(q->record == NULL && q->export == NULL) continue;
+    pthread_mutex_lock(&q->lock);
+    if(q->record != NULL) write_replay(q->record, &rec);
+    if(q->export != NULL) fwrite(smp.s, sizeof(*smp.s), smp.n, q->export);
+    pthread_mutex_unlock(&q->lock);
+  }
+  free(rec.bytes);
+  free(smp.s);
+#if TILES_PER_DIM == 4
+  free(tr.after);
+  free(tr.points);
+#endif
+#ifdef PACKED
+  free_solver(pl.solver);
+#endif
+  return NULL;
+}
+
+static int by_value(const void* a, const void* b) {
+  u64 x = *(const u64*)a, y = *(const u64*)b;
+  return (x > y) - (x < y);
+}
+
+static void report(const struct stats* st, u64* scores, double seconds) {
+  printf("%lu games, %lu moves in %.3fs: %.1f games/s, %.0f moves/s\n",
+    st->games, st->moves, seconds,
+    st->games / seconds, st->moves / seconds);
+  if(st->games == 0) return;
+
+  qsort(scores, st->games, sizeof(u64), by_value);
+  double sum = 0;
+  for(u64 i = 0; i < st->games; ++i) sum += scores[i];
+  printf("score: mean %.0f, min %lu", sum / st->games, scores[0]);
+  static const int percentiles[] = { 10, 25, 50, 75, 90, 99 };
+  FOR(i, 0, sizeof(percentiles) / sizeof(percentiles[0]))
+    printf(", p%d %lu", percentiles[i],
+      scores[(st->games - 1) * percentiles[i] / 100]);
+  printf(", max %lu\n", scores[st->games - 1]);
+
+  printf("max tile   games   share  reached\n");
+  u64 reached = st->games;
+  FOR(t, 1, MAX_TILE + 1) {
+    u64  n = st->max_tiles[t];
+    char tile[24];
+    if(t < 64) snprintf(tile, sizeof(tile), "%llu", 1ull << t);
+    else       snprintf(tile, sizeof(tile), "2^%d", t);
+    if(n > 0)
+      printf("%8s %7lu %6.2f%% %7.2f%%\n", tile, n,
+        100.0 * n / st->games, 100.0 * reached / st->games);
+    reached -= n;
+  }
+}
+
+static void simulate(u64 games, u64 seed, const struct policy* pol,
+                     int threads, FILE* record, FILE* export, bool batch) {
+  struct queue q =
+    { .pol    = pol
+    , .seed   = seed
+    , .games  = games
+    , .next   = 0
+    , .scores = malloc(games * sizeof(u64))
+    , .record = record
+    , .export = export
+    , .batch  = batch
+    , .lock   = PTHREAD_MUTEX_INITIALIZER
+    };
+  struct worker* workers = calloc(threads, sizeof(struct worker));
+  double start = now();
+  for(int i = 0; i < threads; ++i) {
+    workers[i].q = &q;
+    pthread_create(&workers[i].thread, NULL, simulate_worker, &workers[i]);
+  }
+  struct stats st = { 0 };
+  for(int i = 0; i < threads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    add_stats(&st, &workers[i].st);
+  }
+  double seconds = now() - start;
+  printf("%d threads\n", threads);
+  report(&st, q.scores, seconds);
+#if TILES_PER_DIM == 4
+  if(ntuple.train)
+    printf("trained on %.1f games/s per thread\n",
+      st.games / seconds / threads);
+#endif
+  free(workers);
+  free(q.scores);
+}
+
+// Plays back every replay in [f] as fast as the engine goes, checking that
+// each move still changes the board and each game ends on its score.
+static void replay_headless(FILE* f) {
+  struct replay r      = { .bytes = NULL };
+  struct stats  st     = { 0 };
+  u64*          scores = NULL;
+  u64           cap    = 0;
+  double start = now();
+  while(read_replay(f, &r)) {
+    struct g2048_game g  = g2048_new_game(r.seed);
+    bool              ok = true;
+    for(u32 i = 0; ok && i < r.moves; ++i)
+      ok = g2048_update(&g, replay_move(&r, i));
+    if(!ok || g.score != r.score) {
+      fprintf(stderr, "replay %lu (seed %lu) diverges\n", st.games, r.seed);
+      exit(1);
+    }
+    if(st.games == cap) {
+      cap    = cap == 0 ? 1024 : 2 * cap;
+      scores = realloc(scores, cap * sizeof(u64));
+    }
+    scores[st.games] = g.score;
+    st.games += 1;
+    st.moves += r.moves;
+    st.max_tiles[g2048_max_tile(&g.board)] += 1;
+  }
+  report(&st, scores, now() - start);
+  free(scores);
+  free(r.bytes);
+}
+
+#ifdef PACKED
+// sums up a dataset, reading it in place
+static void inspect(const char* path) {
+  struct dataset d = map_dataset(path);
+  u64 games = 0, moves[4] = { 0 }, max_tiles[32] = { 0 };
+  double sum = 0;
+  for(u64 i = 0; i < d.n; ++i) {
+    const struct sample* s = &d.samples[i];
+    moves[s->move & 3] += 1;
+    if(s->turn != 0) continue;
+    games += 1;
+    sum   += s->final_score;
+    max_tiles[s->final_max & 31] += 1;
+  }
+  printf("%lu samples from %lu games, mean final score %.0f\n",
+    d.n, games, games > 0 ? sum / games : 0);
+  FOR(dir, 0, 4)
+    printf("%-6s %10lu %6.2f%%\n", dir_names[dir], moves[dir],
+      d.n > 0 ? 100.0 * moves[dir] / d.n : 0);
+  FOR(t, 1, 32)
+    if(max_tiles[t] > 0) printf("%8u %7lu games\n", 1u << t, max_tiles[t]);
+  unmap_dataset(&d);
+}
+#endif
+
+// --bench times each engine primitive over a fixed corpus of boards: the
+// positions random play reaches just after a move, before its new tile.
+// A round is one pass over the corpus, and the median and p99 are over the
+// rounds, in ns per board. Primitives that go through a backend are timed
+// with each one.
+#define BENCH_SEED   2048
+#define BENCH_BOARDS 4096
+#define BENCH_ROUNDS 201
+
+static struct g2048_rng bench_rng;
+
+static u64 bench_move(const struct g2048_board* bs, u32 n) {
+  u64 sink = 0;
+  for(u32 i = 0; i < n; ++i) {
+    struct g2048_board b = bs[i];
+    sink += g2048_move(&b, i & 3) + b.tiles[0][0];
+  }
+  return sink;
+}
+
+static u64 bench_update(const struct g2048_board* bs, u32 n) {
+  u64 sink = 0;
+  for(u32 i = 0; i < n; ++i) {
+    struct g2048_game g = { .board = bs[i], .score = 0, .rng = bench_rng };
+    g2048_update(&g, i & 3);
+    sink += g.score + g.board.tiles[0][0];
+    bench_rng = g.rng;
+  }
+  return sink;
+}
+
+static u64 bench_legal_moves(const struct g2048_board* bs, u32 n) {
+  u64 sink = 0;
+  for(u32 i = 0; i < n; ++i) sink += g2048_legal_moves(&bs[i]);
+  return sink;
+}
+
+static u64 bench_is_loss(const struct g2048_board* bs, u32 n) {
+  u64 sink = 0;
+  for(u32 i = 0; i < n; ++i) sink += g2048_is_loss(&bs[i]);
+  return sink;
+}
+
+static u64 bench_new_tile(const struct g2048_board* bs, u32 n) {
+  u64 sink = 0;
+  for(u32 i = 0; i < n; ++i) {
+    struct g2048_board b = bs[i];
+    g2048_new_tile(&b, &bench_rng);
+    sink += b.tiles[0][0];
+  }
+  return sink;
+}
+
+#ifdef PACKED
+static struct solver* bench_solver;
+
+// boards spread over the whole corpus, each searched from an empty table
+static u64 bench_expectimax(const struct g2048_board* bs, u32 n) {
+  u64 sink = 0;
+  for(u32 i = 0; i < n; ++i)
+    sink += best_move(bench_solver,
+                      g2048_pack_board(&bs[i * (BENCH_BOARDS / n)]));
+  return sink;
+}
+
+static void clear_tt(void) {
+  memset(bench_solver->tt, 0, sizeof(struct tt_entry) << TT_BITS);
+}
+#endif
+
+struct bench {
+  const char* name;
+  bool per_backend;
+  u32  boards;
+  u32  rounds;
+  u64  (*pass)(const struct g2048_board* bs, u32 n);
+  void (*reset)(void);  // before each round, untimed, unless NULL
+};
+
+static const struct bench benches[] =
+  { { "move",        true,  BENCH_BOARDS, BENCH_ROUNDS, bench_move        }
+  , { "update",      true,  BENCH_BOARDS, BENCH_ROUNDS, bench_update      }
+  , { "legal_moves", false, BENCH_BOARDS, BENCH_ROUNDS, bench_legal_moves }
+  , { "is_loss",     false, BENCH_BOARDS, BENCH_ROUNDS, bench_is_loss     }
+  , { "new_tile",    false, BENCH_BOARDS, BENCH_ROUNDS, bench_new_tile    }
+#ifdef PACKED
+  , { "expectimax",  false, 32,           21,           bench_expectimax,
+      clear_tt }
+#endif
+  };
+
+static void bench_corpus(struct g2048_board* out, u32 n) {
+  struct player pl = { .solver = NULL };
+  u32 k = 0;
+  for(u64 seed = BENCH_SEED; k < n; ++seed) {
+    struct g2048_game g = g2048_new_game(seed);
+    pl.rng = g2048_rng_seed(~seed);
+    for(i8 dir; k < n && (dir = random_policy(&g, &pl)) >= 0;) {
+      out[k] = g.board;
+      g2048_move(&out[k++], dir);
+      g2048_update(&g, dir);
+    }
+  }
+}
+
+// NULL is the inline table move
+static const char* backend_name(const struct g2048_backend* be) {
+  return be == NULL ? "inline" : be->name;
+}
+
+static int by_double(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static void run_bench(const struct bench* be,
+                      const struct g2048_board* corpus) {
+  double* ns = malloc(be->rounds * sizeof(double));
+  volatile u64 sink = 0;
+  bench_rng = g2048_rng_seed(BENCH_SEED);
+  if(be->reset != NULL) be->reset();
+  sink += be->pass(corpus, be->boards);
+  for(u32 r = 0; r < be->rounds; ++r) {
+    if(be->reset != NULL) be->reset();
+    double start = now();
+    sink += be->pass(corpus, be->boards);
+    ns[r] = (now() - start) * 1e9 / be->boards;
+  }
+  qsort(ns, be->rounds, sizeof(double), by_double);
+  printf("%-12s %-8s %12.1f %12.1f\n",
+    be->name, be->per_backend ? backend_name(g2048_backend) : "-",
+    ns[be->rounds / 2], ns[(be->rounds - 1) * 99 / 100]);
+  free(ns);
+}
+
+static void bench(void) {
+  struct g2048_board* corpus = malloc(BENCH_BOARDS * sizeof(*corpus));
+  bench_corpus(corpus, BENCH_BOARDS);
+#ifdef PACKED
+  bench_solver = new_solver(&search_options);
+#endif
+  printf("%d boards from seed %d, %d rounds\n",
+    BENCH_BOARDS, BENCH_SEED, BENCH_ROUNDS);
+  printf("%-12s %-8s %12s %12s\n", "op", "backend", "median ns", "p99 ns");
+  const struct g2048_backend* chosen = g2048_backend;
+  FOR(i, 0, sizeof(benches) / sizeof(benches[0])) {
+    const struct bench* be = &benches[i];
+    if(!be->per_backend) {
+      run_bench(be, corpus);
+      continue;
+    }
+#ifdef PACKED
+    g2048_backend = NULL;
+    run_bench(be, corpus);
+#endif
+    FOR(k, 0, BACKENDS) {
+      g2048_backend = &g2048_backends[k];
+      if(g2048_backend_supported(g2048_backend)) run_bench(be, corpus);
+    }
+    g2048_backend = chosen;
+  }
+#ifdef PACKED
+  print_arena("solver", &bench_solver->arena);
+  free_solver(bench_solver);
+#endif
+  free(corpus);
+}
+
+// --check-spawns N makes about N new tiles with new_tile, and as many with
+// every batch kernel, on boards with from TILES_PER_DIM - 1 empty tiles up
+// to all but one. It counts where each lands and whether it is a 4, and
+// fails if a chi-square test finds them less even than chance would, or a
+// new tile lands on a full tile, or a kernel counts differently from the
+// scalar one, which plays the same games from the same seeds. It then steps
+// about N lanes of each vector kernel in every direction, and fails if any
+// ends up other than scalar_step leaves it.
+#define SPAWN_BOARDS TILES_PER_DIM
+#define SPAWN_LANES  1024
+#define SPAWN_P      1e-6
+
+struct spawns {
+  u64 at[SPAWN_BOARDS][CELLS];
+  u64 fours;
+  u64 bad;
+  u64 n;
+};
+
+// Board [f] has one 2, at the end of row 0 in [*before], moved left in
+// [*after], and its next f rows full of tiles a left move leaves alone.
+static void spawn_board(i8 f, struct g2048_board* before,
+                        struct g2048_board* after) {
+  memset(after, 0, sizeof(*after));
+  after->tiles[0][0] = 1;
+  FOR(i, 1, f + 1) FOR(j, 0, TILES_PER_DIM)
+    after->tiles[i][j] = 3 + ((i + j) & 1);
+  *before = *after;
+  before->tiles[0][0] = 0;
+  before->tiles[0][TILES_PER_DIM - 1] = 1;
+}
+
+static void count_spawn(struct spawns* s, i8 f, u64 empty, i8 k, u8 tile) {
+  if(empty >> k & 1 && (tile == 1 || tile == 2)) {
+    s->at[f][k] += 1;
+    s->fours    += tile == 2;
+  } else {
+    s->bad += 1;
+  }
+}
+
+// seconds taken
+static double check_new_tile(u64 n, u64 seed, struct spawns* s) {
+  struct g2048_rng r = g2048_rng_seed(seed);
+  double           t = now();
+  FOR(f, 0, SPAWN_BOARDS) {
+    struct g2048_board before, after;
+    spawn_board(f, &before, &after);
+    u64 empty = g2048_empty_mask(&after);
+    for(u64 i = 0; i < n / SPAWN_BOARDS; ++i) {
+      struct g2048_board b = after;
+      g2048_new_tile(&b, &r);
+      u64 full = empty & ~g2048_empty_mask(&b);
+      i8  k    = full == 0 ? 0 : __builtin_ctzll(full);
+      count_spawn(s, f, full & (full - 1) ? 0 : empty, k,
+                  b.tiles[k / TILES_PER_DIM][k % TILES_PER_DIM]);
+    }
+    s->n += n / SPAWN_BOARDS;
+  }
+  return now() - t;
+}
+
+#ifdef PACKED
+// Steps [k] on a batch of lanes all on the same board, moving left, and puts
+// the board back after each step. The time includes the moves.
+static double check_batch(const struct batch_kernel* k, u64 n, u64 seed,
+                          struct spawns* s) {
+  const struct batch_kernel* chosen = batch_kernel;
+  struct batch b = new_batch(SPAWN_LANES);
+  for(u32 l = 0; l < SPAWN_LANES; ++l) {
+    struct g2048_rng r = g2048_rng_seed(seed + l);
+    FOR(j, 0, 4) b.rng[j][l] = r.s[j];
+  }
+  u64    rounds = n / SPAWN_BOARDS / SPAWN_LANES;
+  double t      = now();
+  batch_kernel  = k;
+  FOR(f, 0, SPAWN_BOARDS) {
+    struct g2048_board before, after;
+    spawn_board(f, &before, &after);
+    u64 p = g2048_pack_board(&before), m = g2048_pack_board(&after);
+    u64 empty = g2048_empty_mask(&after);
+    for(u64 i = 0; i < rounds; ++i) {
+      for(u32 l = 0; l < SPAWN_LANES; ++l) {
+        b.boards[l] = p;
+        b.moves[l]  = LEFT;
+        b.lost[l]   = 0;
+      }
+      step_batch(&b);
+      for(u32 l = 0; l < SPAWN_LANES; ++l) {
+        u64 d = b.boards[l] ^ m;
+        i8  k = d == 0 ? 0 : __builtin_ctzll(d) / 4;
+        count_spawn(s, f, d >> NIBBLE(0, k) > 0xf ? 0 : empty, k,
+                    d >> NIBBLE(0, k));
+      }
+    }
+    s->n += rounds * SPAWN_LANES;
+  }
+  t = now() - t;
+  batch_kernel = chosen;
+  free_batch(&b);
+  return t;
+}
+#endif
+
+#ifdef HAVE_LANES
+// Steps the lanes of [k] and of the scalar kernel from the same random
+// boards, scores, rng states and moves, LANE_STEPS moves in a row, with some
+// lanes lost or sitting out, and counts the lane steps after which any
+// lane's board, score, rng or lost flag differs. [*secs] is the time [k]
+// took. Tiles start below 2^11, so none reaches 2^15, where the kernels'
+// loss check differs from the tables.
+#define LANE_STEPS 4
+
+static u64 check_lanes(const struct batch_kernel* k, u64 n, u64 seed,
+                       double* secs) {
+  struct batch     a = new_batch(SPAWN_LANES), s = new_batch(SPAWN_LANES);
+  struct g2048_rng r = g2048_rng_seed(seed);
+  u64              rounds = n / SPAWN_LANES / LANE_STEPS, differ = 0;
+  *secs = 0;
+  for(u64 i = 0; i < rounds; ++i) {
+    for(u32 l = 0; l < SPAWN_LANES; ++l) {
+      // small tiles merge often, large ones rarely
+      u32 top = g2048_rng_below(&r, 2) ? 4 : 15 - LANE_STEPS;
+      u64 p   = 0;
+      FOR(c, 0, CELLS)
+        if(g2048_rng_below(&r, 3)) p |= (u64)(1 + g2048_rng_below(&r, top - 1))
+                                        << (4 * c);
+      a.boards[l] = p;
+      a.scores[l] = g2048_rng_next(&r) >> 1;
+      FOR(j, 0, 4) a.rng[j][l] = g2048_rng_next(&r);
+      a.lost[l] = g2048_rng_below(&r, 16) == 0;
+    }
+    FOR(step, 0, LANE_STEPS) {
+      for(u32 l = 0; l < SPAWN_LANES; ++l)
+        a.moves[l] = g2048_rng_below(&r, 16) == 0 ? -1 : g2048_rng_below(&r, 4);
+      memcpy(s.boards, a.boards, SPAWN_LANES * sizeof(u64));
+      memcpy(s.scores, a.scores, SPAWN_LANES * sizeof(u32));
+      FOR(j, 0, 4) memcpy(s.rng[j], a.rng[j], SPAWN_LANES * sizeof(u32));
+      memcpy(s.moves, a.moves, SPAWN_LANES);
+      memcpy(s.lost,  a.lost,  SPAWN_LANES);
+      double t = now();
+      for(u32 l = 0; l < SPAWN_LANES; l += k->width) k->step(&a, l);
+      *secs += now() - t;
+      for(u32 l = 0; l < SPAWN_LANES; ++l) {
+        scalar_step(&s, l);
+        bool same = a.boards[l] == s.boards[l] && a.scores[l] == s.scores[l]
+                 && a.lost[l] == s.lost[l];
+        FOR(j, 0, 4) same &= a.rng[j][l] == s.rng[j][l];
+        differ += !same;
+      }
+      // the next step goes on from the scalar kernel's lanes
+      memcpy(a.boards, s.boards, SPAWN_LANES * sizeof(u64));
+      memcpy(a.scores, s.scores, SPAWN_LANES * sizeof(u32));
+      FOR(j, 0, 4) memcpy(a.rng[j], s.rng[j], SPAWN_LANES * sizeof(u32));
+      memcpy(a.lost, s.lost, SPAWN_LANES);
+    }
+  }
+  free_batch(&a);
+  free_batch(&s);
+  return differ;
+}
+#endif
+
+// the chance of a chi-square of [x] or more with [dof] degrees of freedom,
+// by the Wilson-Hilferty approximation
+static double chi2_p(double x, int dof) {
+  double v = 2.0 / (9 * dof);
+  return erfc((cbrt(x / dof) - (1 - v)) / sqrt(2 * v)) / 2;
+}
+
+// prints a line for [s], and whether it passed
+static bool report_spawns(const char* name, const struct spawns* s,
+                          double secs, const char* same) {
+  double x = 0;
+  int    dof = 0;
+  FOR(f, 0, SPAWN_BOARDS) {
+    struct g2048_board before, after;
+    spawn_board(f, &before, &after);
+    u64 empty = g2048_empty_mask(&after), n = 0;
+    FOR(k, 0, CELLS) n += s->at[f][k];
+    double e = (double)n / __builtin_popcountll(empty);
+    FOR(k, 0, CELLS)
+      if(empty >> k & 1) x += (s->at[f][k] - e) * (s->at[f][k] - e) / e;
+    dof += __builtin_popcountll(empty) - 1;
+  }
+  double cells = chi2_p(x, dof);
+  double n     = s->n - s->bad, four = 0.1 * n;
+  double fours = chi2_p((s->fours - four) * (s->fours - four) / four
+                      + (s->fours - four) * (s->fours - four) / (n - four), 1);
+  bool ok = s->bad == 0 && cells >= SPAWN_P && fours >= SPAWN_P
+         && strcmp(same, "no") != 0;
+  printf("%-9s %12.0f %10.4f %10.4f %8.4f%% %6lu %8s  %s\n",
+    name, s->n / secs, cells, fours, 100 * s->fours / n, s->bad, same,
+    ok ? "ok" : "FAIL");
+  return ok;
+}
+
+static bool check_spawns(u64 n, u64 seed) {
+  printf("%lu new tiles each from seed %lu, failing below p = %g\n",
+    n, seed, SPAWN_P);
+  printf("%-9s %12s %10s %10s %9s %6s %8s\n",
+    "kernel", "spawns/s", "cells p", "fours p", "fours", "bad", "scalar");
+  static struct spawns s;
+  double secs = check_new_tile(n, seed, &s);
+  bool   ok   = report_spawns("new_tile", &s, secs, "-");
+#ifdef PACKED
+  // the scalar kernel is last, so it is counted first
+  static struct spawns scalar;
+  for(i8 k = BATCH_KERNELS - 1; k >= 0; --k) {
+    const struct batch_kernel* bk = &batch_kernels[k];
+    if(!batch_kernel_supported(bk)) continue;
+    memset(&s, 0, sizeof(s));
+    secs = check_batch(bk, n, seed, &s);
+    if(k == BATCH_KERNELS - 1) scalar = s;
+    ok &= report_spawns(bk->name, &s, secs, k == BATCH_KERNELS - 1 ? "-"
+                        : memcmp(&s, &scalar, sizeof(s)) == 0 ? "same" : "no");
+  }
+#endif
+#ifdef HAVE_LANES
+  printf("%lu lane steps each from seed %lu, against scalar\n", n, seed);
+  printf("%-9s %12s %10s\n", "kernel", "steps/s", "differ");
+  FOR(k, 0, BATCH_KERNELS - 1) {
+    const struct batch_kernel* bk = &batch_kernels[k];
+    if(!batch_kernel_supported(bk)) continue;
+    u64 differ = check_lanes(bk, n, seed, &secs);
+    u64 steps  = n / SPAWN_LANES / LANE_STEPS * SPAWN_LANES * LANE_STEPS;
+    printf("%-9s %12.0f %10lu  %s\n", bk->name, steps / secs, differ,
+      differ == 0 ? "ok" : "FAIL");
+    ok &= differ == 0;
+  }
+#endif
+  return ok;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+    "usage: 2048 [--backend NAME]"
+    " [--simulate GAMES [--policy NAME] [--seed SEED] [--threads N]]\n"
+    "            [--search-threads N] [--depth PLIES | --think-ms MS]\n"
+    "            [--record FILE | --replay FILE [--headless]]\n"
+    "            [--export FILE] [--inspect FILE] [--batch KERNEL]\n"
+    "            [--bench] [--check-spawns N] [--seed SEED]\n"
+    "            [--build-tablebase FILE] [--tablebase FILE]\n"
+    "            [--ntuple FILE | --train FILE [--alpha A] [--lambda L]]\n"
+    "            [--autoplay [--fps FPS]] [--serve ADDR [--threads N]]\n"
+    "backends:");
+  FOR(i, 0, BACKENDS)
+    if(g2048_backend_supported(&g2048_backends[i]))
+      fprintf(stderr, " %s", g2048_backends[i].name);
+#ifdef PACKED
+  fprintf(stderr, "\nbatch kernels:");
+  FOR(i, 0, BATCH_KERNELS)
+    if(batch_kernel_supported(&batch_kernels[i]))
+      fprintf(stderr, " %s", batch_kernels[i].name);
+#endif
+  fprintf(stderr, "\npolicies:");
+  FOR(i, 0, POLICIES) fprintf(stderr, " %s", policies[i].name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+#ifdef HAVE_SERVER
+// --serve ADDR keeps games for clients over a socket: a Unix socket if ADDR
+// has a '/', else a TCP port. A client sends 16-byte requests, as many at a
+// time as it likes, and gets a 16-byte response to each, in order:
+//
+//   request   u8 op, u8 dir, u16 0, u32 game, u64 seed
+//   response  u8 status, u8 0, u16 0, u32 value, u64 board
+//
+// OP_NEW starts a game from [seed], and [value] is its id. OP_MOVE moves
+// [game] in [dir], and [value] is the points the move scored. OP_FREE ends
+// [game]. [board] is the game's packed board after the request. Numbers are
+// little-endian. A connection's games are its own, and end with it.
+//
+// Each of the server's threads has an epoll set, and an arena with a pool of
+// SERVE_GAMES games and one of SERVE_CONNS connections, the ones it
+// accepted. Whatever a read brings in is answered with one write, so
+// pipelined requests cost a syscall per batch.
+#define SERVE_GAMES  65536
+#define SERVE_CONNS  1024
+#define SERVE_BUFFER 65536
+#define SERVE_EVENTS 64
+
+enum serve_op     { OP_NEW, OP_MOVE, OP_FREE };
+enum serve_status { ST_OK, ST_UNCHANGED, ST_LOST, ST_FULL, ST_BAD };
+
+struct serve_request {
+  u8  op;
+  u8  dir;
+  u16 reserved;
+  u32 game;
+  u64 seed;
+};
+
+struct serve_response {
+  u8  status;
+  u8  reserved[3];
+  u32 value;
+  u64 board;
+};
+
+// a game of the pool, in its connection's list; [conn] is 0 once it is free
+struct slot {
+  struct g2048_game game;
+  u32               conn;
+  u32               next;
+  u32               prev;
+};
+
+struct conn {
+  int  fd;
+  u32  id;
+  u32  games;
+  bool writing;  // waiting for the socket to take the rest of [out]
+  u32  in_len;
+  u32  out_len;
+  u32  out_sent;
+  u8   in [SERVE_BUFFER];
+  u8   out[SERVE_BUFFER];
+};
+
+struct server {
+  int          listen;
+  int          epoll;
+  u32          ids;
+  struct arena arena;
+  struct pool  slots;
+  struct pool  conns;
+};
+
+static void die(const char* what) {
+  perror(what);
+  exit(1);
+}
+
+static int listen_on(const char* addr) {
+  int fd;
+  if(strchr(addr, '/') != NULL) {
+    struct sockaddr_un a = { .sun_family = AF_UNIX };
+    if(strlen(addr) >= sizeof(a.sun_path)) usage();
+    strcpy(a.sun_path, addr);
+    unlink(addr);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&a, sizeof(a)) < 0) die(addr);
+  } else {
+    struct sockaddr_in a =
+      { .sin_family = AF_INET, .sin_port = htons(atoi(addr)),
+        .sin_addr = { htonl(INADDR_ANY) } };
+    int on = 1;
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(fd < 0) die(addr);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(bind(fd, (struct sockaddr*)&a, sizeof(a)) < 0) die(addr);
+  }
+  if(listen(fd, SOMAXCONN) < 0) die(addr);
+  return fd;
+}
+
+static struct slot* slot_at(struct server* sv, u32 s) {
+  return pool_at(&sv->slots, s);
+}
+
+static struct slot* own_slot(struct server* sv, struct conn* c, u32 game) {
+  return game < sv->slots.fresh && slot_at(sv, game)->conn == c->id
+       ? slot_at(sv, game) : NULL;
+}
+
+static u32 new_slot(struct server* sv, struct conn* c) {
+  struct slot* sl = pool_take(&sv->slots);
+  if(sl == NULL) return NO_OBJECT;
+  u32 s = pool_index(&sv->slots, sl);
+  sl->conn = c->id;
+  sl->prev = NO_OBJECT;
+  sl->next = c->games;
+  if(c->games != NO_OBJECT) slot_at(sv, c->games)->prev = s;
+  c->games = s;
+  return s;
+}
+
+static void free_slot(struct server* sv, struct conn* c, u32 s) {
+  struct slot* sl = slot_at(sv, s);
+  if(sl->prev != NO_OBJECT) slot_at(sv, sl->prev)->next = sl->next;
+  else                      c->games                    = sl->next;
+  if(sl->next != NO_OBJECT) slot_at(sv, sl->next)->prev = sl->prev;
+  sl->conn = 0;
+  pool_give(&sv->slots, sl);
+}
+
+static struct serve_response serve(struct server* sv, struct conn* c,
+                                   const struct serve_request* rq) {
+  struct serve_response rs = { .status = ST_BAD };
+  struct slot* sl = own_slot(sv, c, rq->game);
+  switch(rq->op) {
+  case OP_NEW: {
+    u32 s = new_slot(sv, c);
+    if(s == NO_OBJECT) {
+      rs.status = ST_FULL;
+      break;
+    }
+    struct g2048_game* g = &slot_at(sv, s)->game;
+    *g = g2048_new_game(rq->seed);
+    rs.status = ST_OK;
+    rs.value  = s;
+    rs.board  = g2048_pack_board(&g->board);
+    break;
+  }
+  case OP_MOVE: {
+    if(sl == NULL || rq->dir > UP) break;
+    struct g2048_game* g = &sl->game;
+    u64 score = g->score;
+    rs.status = !g2048_update(g, rq->dir)  ? ST_UNCHANGED
+              : g2048_is_loss(&g->board)   ? ST_LOST : ST_OK;
+    rs.value  = g->score - score;
+    rs.board  = g2048_pack_board(&g->board);
+    break;
+  }
+  case OP_FREE:
+    if(sl == NULL) break;
+    free_slot(sv, c, rq->game);
+    rs.status = ST_OK;
+    break;
+  }
+  return rs;
+}
+
+static void close_conn(struct server* sv, struct conn* c) {
+  while(c->games != NO_OBJECT) free_slot(sv, c, c->games);
+  close(c->fd);
+  pool_give(&sv->conns, c);
+}
+
+static void watch(struct server* sv, struct conn* c, bool writing) {
+  struct epoll_event ev =
+    { .events = writing ? EPOLLOUT : EPOLLIN, .data.ptr = c };
+  c->writing = writing;
+  epoll_ctl(sv->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// writes what is left of [out]; false if the connection is gone
+static bool flush_conn(struct server* sv, struct conn* c) {
+  while(c->out_sent < c->out_len) {
+    ssize_t n = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+    if(n < 0 && errno == EAGAIN) {
+      if(!c->writing) watch(sv, c, true);
+      return true;
+    }
+    if(n <= 0) return false;
+    c->out_sent += n;
+  }
+  c->out_len = c->out_sent = 0;
+  if(c->writing) watch(sv, c, false);
+  return true;
+}
+
+// one read's worth of requests, answered; false if the connection is gone.
+// A connection isn't read while its answers are still being written, and a
+// full buffer of requests only needs as full a buffer of responses.
+static bool serve_conn(struct server* sv, struct conn* c) {
+  if(c->out_sent < c->out_len) return flush_conn(sv, c);
+  ssize_t n = read(c->fd, c->in + c->in_len, SERVE_BUFFER - c->in_len);
+  if(n < 0 && errno == EAGAIN) return true;
+  if(n <= 0) return false;
+  c->in_len += n;
+  u32 k = c->in_len / sizeof(struct serve_request);
+  for(u32 i = 0; i < k; ++i) {
+    // both are little-endian on the wire, whatever the host's order
+    struct serve_request  rq;
+    memcpy(&rq, c->in + i * sizeof(rq), sizeof(rq));
+    rq.game = le32toh(rq.game);
+    rq.seed = le64toh(rq.seed);
+    struct serve_response rs = serve(sv, c, &rq);
+    rs.value = htole32(rs.value);
+    rs.board = htole64(rs.board);
+    memcpy(c->out + c->out_len, &rs, sizeof(rs));
+    c->out_len += sizeof(rs);
+  }
+  c->in_len -= k * sizeof(struct serve_request);
+  memmove(c->in, c->in + k * sizeof(struct serve_request), c->in_len);
+  return flush_conn(sv, c);
+}
+
+static void accept_conn(struct server* sv) {
+  int fd = accept(sv->listen, NULL, NULL);
+  if(fd < 0) return;
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  struct conn* c = pool_take(&sv->conns);
+  if(c == NULL) {
+    close(fd);
+    return;
+  }
+  // only the fields before the buffers; those are written before read
+  memset(c, 0, offsetof(struct conn, in));
+  c->fd    = fd;
+  c->id    = ++sv->ids;
+  c->games = NO_OBJECT;
+  // ids wrap around past 0, which marks free slots
+  if(c->id == 0) c->id = ++sv->ids;
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+  epoll_ctl(sv->epoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void* server_thread(void* arg) {
+  struct server* sv = arg;
+  // made by the thread that uses it, so its pages are on the thread's node
+  size_t games = (size_t)SERVE_GAMES * sizeof(struct slot) + ARENA_ALIGN;
+  size_t conns = (size_t)SERVE_CONNS * sizeof(struct conn) + ARENA_ALIGN;
+  sv->arena = new_arena(games + conns);
+  sv->slots = new_pool(&sv->arena, sizeof(struct slot), SERVE_GAMES);
+  sv->conns = new_pool(&sv->arena, sizeof(struct conn), SERVE_CONNS);
+  sv->epoll = epoll_create1(0);
+  // EPOLLEXCLUSIVE wakes one thread, not all of them, for each connection
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE };
+  epoll_ctl(sv->epoll, EPOLL_CTL_ADD, sv->listen, &ev);
+  for(;;) {
+    struct epoll_event evs[SERVE_EVENTS];
+    int n = epoll_wait(sv->epoll, evs, SERVE_EVENTS, -1);
+    FOR(i, 0, n) {
+      struct conn* c = evs[i].data.ptr;
+      if(c == NULL)                  accept_conn(sv);
+      else if(!serve_conn(sv, c))    close_conn(sv, c);
+    }
+  }
+  return NULL;
+}
+
+static void run_server(const char* addr, int threads) {
+  int fd = listen_on(addr);
+  signal(SIGPIPE, SIG_IGN);
+  printf("serving on %s with %d threads\n", addr, threads);
+  fflush(stdout);
+  struct server* servers = calloc(threads, sizeof(struct server));
+  pthread_t*     pool    = calloc(threads, sizeof(pthread_t));
+  for(int i = 0; i < threads; ++i) {
+    servers[i].listen = fd;
+    pthread_create(&pool[i], NULL, server_thread, &servers[i]);
+  }
+  for(int i = 0; i < threads; ++i) pthread_join(pool[i], NULL);
+}
+#endif
+
+// the game being played, written to [session_file] at exit if it is set
+static struct replay session;
+static FILE*         session_file;
+
+static void save_session(void) {
+  if(session_file == NULL) return;
+  write_replay(session_file, &session);
+  fclose(session_file);
+  session_file = NULL;
+}
+
+static void sigint(int _) {
+  endwin();
+  save_session();
+  exit(0);
+}
+
+static void start_curses(void) {
+  init_glyphs();
+  struct sigaction act;
+  act.sa_handler = sigint;
+  sigaction(SIGINT, &act, NULL);
+  initscr();
+  curs_set(0);
+  cbreak();
+  noecho();
+  keypad(stdscr, true);
+#ifdef INSTRUMENT
+  g2048_probe_polled = true;
+#endif
+}
+
+// Curses owns the terminal, so the probes' counts wait for poll_probes,
+// which the loops call as they wait for keys, at least every PROBE_POLL_MS.
+// They are printed with curses out of the way, and seen once it ends.
+#ifdef INSTRUMENT
+#define PROBE_POLL_MS 200
+
+static void poll_probes(void) {
+  if(!g2048_probe_waiting()) return;
+  def_prog_mode();
+  endwin();
+  g2048_probe_dump();
+  reset_prog_mode();
+  refresh();
+}
+#else
+static void poll_probes(void) {}
+#endif
+
+// Animated replays show a move every REPLAY_MS, and the final board of each
+// game for REPLAY_END_MS. q stops them.
+#define REPLAY_MS     50
+#define REPLAY_END_MS 1000
+
+static void replay_animated(FILE* f) {
+  struct replay r  = { .bytes = NULL };
+  struct screen sc = { .lines = 0 };
+  u64  games = 0;
+  bool quit  = false;
+  start_curses();
+  while(!quit && read_replay(f, &r)) {
+    struct g2048_game g = g2048_new_game(r.seed);
+    timeout(REPLAY_MS);
+    for(u32 i = 0; !quit && i < r.moves; ++i) {
+      draw(&sc, &g, "");
+      poll_probes();
+      quit = getch() == 'q';
+      g2048_update(&g, replay_move(&r, i));
+    }
+    draw(&sc, &g, "");
+    poll_probes();
+    timeout(REPLAY_END_MS);
+    quit |= getch() == 'q';
+    games += 1;
+  }
+  endwin();
+  printf("Replayed %lu games\n", games);
+  free(r.bytes);
+}
+
+// Autoplay lets [pol] play game after game at full speed, seeded seed,
+// seed + 1, and so on, and draws the board at most [fps] times a second,
+// whatever moves, or games, fell between; nothing waits on the screen, so
+// the engine never sits idle. q stops it.
+#define AUTOPLAY_FPS 30
+#ifdef PACKED
+#define AUTOPLAY_POLICY "expectimax"
+#else
+#define AUTOPLAY_POLICY "greedy"
+#endif
+
+static void autoplay(const struct policy* pol, u64 seed, double fps) {
+  struct screen sc = { .lines = 0 };
+  struct player pl = { .solver = NULL };
+  u64  games = 0, moves = 0;
+  bool quit  = false;
+  char status[HINT_LEN] = "";
+  start_curses();
+  nodelay(stdscr, true);
+  double start = now(), next_frame = start;
+  while(!quit) {
+    struct g2048_game g = g2048_new_game(seed + games);
+    pl.rng = g2048_rng_seed(~(seed + games));
+    for(i8 dir; !quit && (dir = pol->choose(&g, &pl)) >= 0; ++moves) {
+      g2048_update(&g, dir);
+      double t = now();
+      if(t < next_frame) continue;
+      next_frame = t + 1 / fps;
+      snprintf(status, sizeof(status), "#%lu, %.0fk moves/s",
+        games + 1, moves / (t - start) / 1000);
+      draw(&sc, &g, status);
+      poll_probes();
+      quit = getch() == 'q';
+    }
+    games += 1;
+  }
+  endwin();
+  printf("Autoplayed %lu games, %lu moves\n", games, moves);
+#ifdef PACKED
+  free_solver(pl.solver);
+#endif
+}
+
+#ifdef PACKED
+// The ponderer thinks about the game on a thread of its own, so the UI never
+// waits on a search. Each board the UI draws is posted to it; it searches
+// that board first, then the boards its move could lead to, twos before
+// fours, until a new board is posted. Every move it finds goes in a small
+// cache by board, so the next board is usually solved before it is drawn.
+#define PONDER_CACHE   256
+#define PONDER_POLL_MS 20
+
+struct pondered {
+  u64 board;
+  i8  move;
+};
+
+struct ponderer {
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;
+  struct solver*  solver;
+  u64             board;  // the last posted
+  bool            posted;
+  bool            quit;
+  struct pondered cache[PONDER_CACHE];
+};
+
+static struct pondered* pondered(struct ponderer* pd, u64 p) {
+  return &pd->cache[(p * 0x9e3779b97f4a7c15ull) >> (64 - 8)];
+}
+
+// the cached move for [p], or -1; the lock must be held
+static i8 cached_move(struct ponderer* pd, u64 p) {
+  struct pondered* e = pondered(pd, p);
+  return e->board == p ? e->move : -1;
+}
+
+// searches [p] unless it is solved, and caches its move; false once a newer
+// board is posted than [root]
+static bool ponder_board(struct ponderer* pd, u64 root, u64 p, i8* move) {
+  pthread_mutex_lock(&pd->lock);
+  bool stale = pd->quit || pd->board != root;
+  *move = cached_move(pd, p);
+  pthread_mutex_unlock(&pd->lock);
+  if(stale) return false;
+  if(*move >= 0) return true;
+  *move = best_move(pd->solver, p);
+  if(*move < 0) return true;
+  pthread_mutex_lock(&pd->lock);
+  *pondered(pd, p) = (struct pondered){ .board = p, .move = *move };
+  pthread_mutex_unlock(&pd->lock);
+  return true;
+}
+
+static void* ponder_thread(void* arg) {
+  struct ponderer* pd = arg;
+  for(;;) {
+    pthread_mutex_lock(&pd->lock);
+    while(!pd->quit && !pd->posted) pthread_cond_wait(&pd->wake, &pd->lock);
+    if(pd->quit) break;
+    u64 root   = pd->board;
+    pd->posted = false;
+    pthread_mutex_unlock(&pd->lock);
+
+    i8 move;
+    if(!ponder_board(pd, root, root, &move) || move < 0) continue;
+    u64  after = g2048_bb_merge(root, move);
+    u64  empty = g2048_bb_empty(after);
+    bool fresh = true;
+    for(u8 shift = 0; fresh && shift < 2; ++shift)
+      for(u64 m = empty; fresh && m != 0; m &= m - 1)
+        fresh = ponder_board(pd, root, after | (m & -m) << shift, &move);
+  }
+  pthread_mutex_unlock(&pd->lock);
+  return NULL;
+}
+
+static struct ponderer* new_ponderer(void) {
+  struct ponderer* pd = calloc(1, sizeof(struct ponderer));
+  pd->solver = new_solver(&search_options);
+  pthread_mutex_init(&pd->lock, NULL);
+  pthread_cond_init(&pd->wake, NULL);
+  pthread_create(&pd->thread, NULL, ponder_thread, pd);
+  return pd;
+}
+
+static void free_ponderer(struct ponderer* pd) {
+  if(pd == NULL) return;
+  pthread_mutex_lock(&pd->lock);
+  pd->quit = true;
+  pthread_cond_signal(&pd->wake);
+  pthread_mutex_unlock(&pd->lock);
+  pthread_join(pd->thread, NULL);
+  free_solver(pd->solver);
+  free(pd);
+}
+
+// starts thinking about [p], unless it already is
+static void ponder(struct ponderer* pd, u64 p) {
+  pthread_mutex_lock(&pd->lock);
+  if(pd->board != p) {
+    pd->board  = p;
+    pd->posted = true;
+    pthread_cond_signal(&pd->wake);
+  }
+  pthread_mutex_unlock(&pd->lock);
+}
+
+// the move for [p] if it is ready, or -1
+static i8 pondered_move(struct ponderer* pd, u64 p) {
+  pthread_mutex_lock(&pd->lock);
+  i8 move = cached_move(pd, p);
+  pthread_mutex_unlock(&pd->lock);
+  return move;
+}
+#endif
+
+int main(int argc, char** argv) {
+#ifdef PACKED
+  init_solver_tables();
+  init_batch_kernels();
+#endif
+  const struct policy* pol = NULL;
+  u64      games = 0;
+  u64      seed  = time(NULL);
+  int    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(threads > MAX_THREADS) threads = MAX_THREADS;
+  FILE*   record = NULL;
+  FILE*   replay = NULL;
+  FILE*   export = NULL;
+#ifdef PACKED
+  const char* dataset = NULL;
+#endif
+  bool  headless = false;
+  bool     batch = false;
+  bool   benched = false;
+  u64     spawns = 0;
+  bool autoplayed = false;
+#ifdef HAVE_SERVER
+  const char* serve_addr = NULL;
+#endif
+  double     fps = AUTOPLAY_FPS;
+  for(int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* val = i + 1 < argc ? argv[i+1] : NULL;
+    if(strcmp(arg, "--headless") == 0) {
+      headless = true;
+      continue;
+    }
+    if(strcmp(arg, "--bench") == 0) {
+      benched = true;
+      continue;
+    }
+    if(strcmp(arg, "--autoplay") == 0) {
+      autoplayed = true;
+      continue;
+    }
+    if(val == NULL) usage();
+    ++i;
+    if(strcmp(arg, "--simulate") == 0) {
+      games = strtoull(val, NULL, 10);
+    } else if(strcmp(arg, "--check-spawns") == 0) {
+      spawns = strtoull(val, NULL, 10);
+    } else if(strcmp(arg, "--seed") == 0) {
+      seed = strtoull(val, NULL, 10);
+    } else if(strcmp(arg, "--threads") == 0) {
+      threads = atoi(val);
+      if(threads < 1 || threads > MAX_THREADS) usage();
+#ifdef PACKED
+    } else if(strcmp(arg, "--search-threads") == 0) {
+      search_options.threads = atoi(val);
+      if(search_options.threads < 1 || search_options.threads > MAX_THREADS)
+        usage();
+    } else if(strcmp(arg, "--depth") == 0) {
+      search_options.depth = atoi(val);
+    } else if(strcmp(arg, "--think-ms") == 0) {
+      search_options.think = atof(val) / 1000;
+#endif
+    } else if(strcmp(arg, "--record") == 0) {
+      record = open_or_die(val, "ab");
+    } else if(strcmp(arg, "--replay") == 0) {
+      replay = open_or_die(val, "rb");
+#ifdef PACKED
+    } else if(strcmp(arg, "--export") == 0) {
+      export = open_dataset_for_append(val);
+    } else if(strcmp(arg, "--inspect") == 0) {
+      dataset = val;
+    } else if(strcmp(arg, "--batch") == 0) {
+      batch_kernel = NULL;
+      FOR(k, 0, BATCH_KERNELS)
+        if(strcmp(val, batch_kernels[k].name) == 0
+        && batch_kernel_supported(&batch_kernels[k]))
+          batch_kernel = &batch_kernels[k];
+      if(batch_kernel == NULL) usage();
+      batch = true;
+#endif
+#if TILES_PER_DIM == 4
+    } else if(strcmp(arg, "--build-tablebase") == 0) {
+      build_tablebase(val);
+      return 0;
+    } else if(strcmp(arg, "--tablebase") == 0) {
+      load_tablebase(val);
+    } else if(strcmp(arg, "--ntuple") == 0) {
+      map_ntuple(val, false);
+    } else if(strcmp(arg, "--train") == 0) {
+      map_ntuple(val, true);
+    } else if(strcmp(arg, "--alpha") == 0) {
+      ntuple.alpha = atof(val);
+    } else if(strcmp(arg, "--lambda") == 0) {
+      ntuple.lambda = atof(val);
+#endif
+    } else if(strcmp(arg, "--policy") == 0) {
+      pol = policy_named(val);
+      if(pol == NULL) usage();
+#ifdef HAVE_SERVER
+    } else if(strcmp(arg, "--serve") == 0) {
+      serve_addr = val;
+#endif
+    } else if(strcmp(arg, "--fps") == 0) {
+      fps = atof(val);
+      if(fps <= 0) usage();
+    } else if(strcmp(arg, "--backend") == 0) {
+      const struct g2048_backend* be = NULL;
+      FOR(k, 0, BACKENDS)
+        if(strcmp(val, g2048_backends[k].name) == 0
+        && g2048_backend_supported(&g2048_backends[k])) be = &g2048_backends[k];
+      if(be == NULL) usage();
+      g2048_backend = be;
+    } else {
+      usage();
+    }
+  }
+
+  // autoplay defaults to the strongest policy that needs no file
+  if(pol == NULL) pol = policy_named(autoplayed ? AUTOPLAY_POLICY : "random");
+#if TILES_PER_DIM == 4
+  // training plays the network it trains; playing it takes one
+  if(ntuple.train) pol = policy_named("ntuple");
+  if(pol->choose == ntuple_policy && ntuple.w == NULL) usage();
+#endif
+#ifdef HAVE_SERVER
+  if(serve_addr != NULL) {
+    run_server(serve_addr, threads);
+    return 0;
+  }
+#endif
+  if(benched) {
+    bench();
+    return 0;
+  }
+  if(spawns > 0 && spawns < SPAWN_BOARDS * SPAWN_LANES) {
+    // fewer would leave the batch kernels nothing to count
+    fprintf(stderr, "--check-spawns needs at least %d new tiles\n",
+      SPAWN_BOARDS * SPAWN_LANES);
+    return 1;
+  }
+  if(spawns > 0) return check_spawns(spawns, seed) ? 0 : 1;
+  if(games > 0) {
+    // batches play games out of order, and don't record them
+    if(batch && (record != NULL || export != NULL)) usage();
+#if TILES_PER_DIM == 4
+    if(batch && ntuple.train) usage();
+#endif
+    simulate(games, seed, pol, threads, record, export, batch);
+    if(record != NULL) fclose(record);
+    if(export != NULL) fclose(export);
+    return 0;
+  }
+#ifdef PACKED
+  if(dataset != NULL) {
+    inspect(dataset);
+    return 0;
+  }
+#endif
+  if(replay != NULL) {
+    if(headless) replay_headless(replay);
+    else         replay_animated(replay);
+    fclose(replay);
+    return 0;
+  }
+
+  if(autoplayed) {
+    autoplay(pol, seed, fps);
+    return 0;
+  }
+
+  session.seed = seed;
+  session_file = record;
+  start_curses();
+  struct g2048_game g      = g2048_new_game(seed);
+  struct screen     sc     = { .lines = 0 };
+  // 'u' takes moves back; the session loses them too, so it still replays
+  static struct g2048_history undo;
+#ifdef PACKED
+  // started by the first hint, and pondering every board from then on; a
+  // hint that isn't ready yet polls for it
+  struct ponderer* pd   = NULL;
+  bool             want = false;
+#endif
+  const char*       hint   = "";
+  while(!g2048_is_victory(&g.board) && !g2048_is_loss(&g.board)) {
+#ifdef PACKED
+    u64 p = g2048_pack_board(&g.board);
+    if(want) {
+      i8 move = pondered_move(pd, p);
+      want = move < 0;
+      hint = want ? "thinking" : dir_names[move];
+    }
+#endif
+    draw(&sc, &g, hint);
+    poll_probes();
+    int wait = -1;
+#ifdef PACKED
+    if(pd != NULL) ponder(pd, p);
+    if(want) wait = PONDER_POLL_MS;
+#endif
+#ifdef INSTRUMENT
+    if(wait < 0) wait = PROBE_POLL_MS;
+#endif
+    timeout(wait);
     int key = getch();
-    update(&g, key);
+    if(key == ERR) continue;
+    i8  dir = dir_of_key(key);
+    hint = "";
+#ifdef PACKED
+    want = key == 'h';
+    if(want && pd == NULL) pd = new_ponderer();
+#endif
+    struct g2048_game before = g;
+    if(dir >= 0 && g2048_update(&g, dir)) {
+      g2048_push_game(&undo, &before);
+      replay_add(&session, dir);
+      session.score = g.score;
+    } else if(key == 'u' && g2048_pop_game(&undo, &g)) {
+      replay_pop(&session);
+      session.score = g.score;
+    }
   }
+#ifdef PACKED
+  free_ponderer(pd);
+#endif
   endwin();
-  printf("You %s, with score %d!\n",
-    is_victory(&g.board) ? "WIN" : "LOSE",
+  printf("You %s, with score %lu!\n",
+    g2048_is_victory(&g.board) ? "WIN" : "LOSE",
     g.score);
+  save_session();
 }
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "internal.h"
+
+// The probes' counts, shared by every thread, and how to print them.
+#ifdef INSTRUMENT
+static const char* probe_names[PROBES] =
+  { "update", "is_loss", "new_tile", "draw" };
+
+#define PROBE_BUCKETS 40
+
+struct probe_stats {
+  u64 calls;
+  u64 ticks;
+  u64 hist[PROBE_BUCKETS];
+};
+
+static struct probe_stats    probe_stats[PROBES];
+static volatile sig_atomic_t probe_dump;
+// when the probes started, to tell ticks in nanoseconds
+static u64    probe_ticks0;
+static struct timespec probe_time0;
+
+static void dump_probes(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  double ns = (t.tv_sec - probe_time0.tv_sec) * 1e9
+            + (t.tv_nsec - probe_time0.tv_nsec);
+  double per_ns = (g2048_ticks() - probe_ticks0) / ns;
+  fprintf(stderr, "%-10s %12s %12s %12s\n",
+    "probe", "calls", "mean ns", "total ms");
+  FOR(p, 0, PROBES) {
+    const struct probe_stats* st = &probe_stats[p];
+    u64 calls = __atomic_load_n(&st->calls, __ATOMIC_RELAXED);
+    u64 total = __atomic_load_n(&st->ticks, __ATOMIC_RELAXED);
+    if(calls == 0) continue;
+    fprintf(stderr, "%-10s %12lu %12.1f %12.3f\n", probe_names[p], calls,
+      total / per_ns / calls, total / per_ns / 1e6);
+    FOR(b, 0, PROBE_BUCKETS) {
+      u64 n = __atomic_load_n(&st->hist[b], __ATOMIC_RELAXED);
+      if(n > 0) fprintf(stderr, "  < %12lu ticks %12lu\n", 2ul << b, n);
+    }
+  }
+}
+
+bool g2048_probe_polled;
+
+bool g2048_probe_waiting(void) { return probe_dump; }
+
+void g2048_probe_dump(void) {
+  probe_dump = 0;
+  dump_probes();
+}
+
+void g2048_probe_end(struct g2048_probe_timer* t) {
+  u64 d = g2048_ticks() - t->start;
+  i8  b = 63 - __builtin_clzll(d | 1);
+  struct probe_stats* st = &probe_stats[t->p];
+  __atomic_fetch_add(&st->calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&st->ticks, d, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&st->hist[b < PROBE_BUCKETS ? b : PROBE_BUCKETS - 1], 1,
+    __ATOMIC_RELAXED);
+  if(probe_dump && !g2048_probe_polled
+  && __atomic_exchange_n(&probe_dump, 0, __ATOMIC_RELAXED))
+    dump_probes();
+}
+
+static void sigusr1(int _) { probe_dump = 1; }
+
+static void init_probes(void) {
+  probe_ticks0 = g2048_ticks();
+  clock_gettime(CLOCK_MONOTONIC, &probe_time0);
+  atexit(dump_probes);
+  struct sigaction act = { .sa_handler = sigusr1, .sa_flags = SA_RESTART };
+  sigaction(SIGUSR1, &act, NULL);
+}
+#endif
+
+static void move_nonzero_first(u8 row[TILES_PER_DIM]) {
+  i8 start_of_zeros = 0;
+  FOR(i, 0, TILES_PER_DIM) {
+    if(row[i] == 0) continue;
+    // consider the case [i == start_of_zeros]
+    u8 t = row[i];
+    row[i] = 0;
+    row[start_of_zeros++] = t;
+  }
+}
+
+// returns the points scored by the merges
+static u32 merge_row_left(u8 row[TILES_PER_DIM]) {
+  u32 score = 0;
+  move_nonzero_first(row);
+  FOR(i, 0, TILES_PER_DIM - 1) {
+    if(row[i] == 0 || row[i] != row[i+1]) continue;
+    row[i]  += 1;
+    row[i+1] = 0;
+    score   += 1u << row[i];
+  }
+  move_nonzero_first(row);
+  return score;
+}
+
+static void reverse(u8 row[TILES_PER_DIM]) {
+  FOR(i, 0, TILES_PER_DIM / 2) {
+    u8 t = row[i];
+    row[i] = row[TILES_PER_DIM-i-1];
+    row[TILES_PER_DIM-i-1] = t;
+  }
+}
+
+static u32 merge_row_right(u8 row[TILES_PER_DIM]) {
+  reverse(row);
+  u32 score = merge_row_left(row);
+  reverse(row);
+  return score;
+}
+
+static void transpose(struct g2048_board* b) {
+  FOR(i, 0, TILES_PER_DIM) FOR(j, i+1, TILES_PER_DIM) {
+    u8 t = b->tiles[i][j];
+    b->tiles[i][j] = b->tiles[j][i];
+    b->tiles[j][i] = t;
+  }
+}
+
+// Columns are moved as rows of the transposed board, which is transposed back
+// in place; nothing is copied. Like every move kernel, returns the points.
+static u32 scalar_move(struct g2048_board* b, i8 dir) {
+  bool columns = dir == UP || dir == DOWN;
+  u32  points  = 0;
+  if(columns) transpose(b);
+  FOR(i, 0, TILES_PER_DIM) {
+    if(dir == LEFT || dir == UP) points += merge_row_left (b->tiles[i]);
+    else                         points += merge_row_right(b->tiles[i]);
+  }
+  if(columns) transpose(b);
+  return points;
+}
+
+// The SIMD kernel moves all four rows of the 16-byte board at once, as one
+// register. Every direction is a shuffle that puts the board in left-moving
+// order, a left move, and the inverse shuffle. Only a 4x4 board fills one.
+#if TILES_PER_DIM != 4
+#elif defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define HAVE_SIMD 1
+#define SIMD __attribute__((target("ssse3")))
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_SIMD 1
+#define SIMD
+#endif
+
+#ifdef HAVE_SIMD
+static u8  simd_pre [4][16] align(16);
+static u8  simd_post[4][16] align(16);
+// compact[m] gathers the tiles of a row with nonzero mask m to its left
+static u32 compact  [16];
+
+static void init_simd_tables(void) {
+  FOR(dir, 0, 4) {
+    struct g2048_board order;
+    FOR_TILES(i, j) order.tiles[i][j] = i * TILES_PER_DIM + j;
+    if(dir == UP || dir == DOWN)    transpose(&order);
+    if(dir == RIGHT || dir == DOWN)
+      FOR(i, 0, TILES_PER_DIM) reverse(order.tiles[i]);
+    FOR_TILES(i, j) {
+      u8 k = order.tiles[i][j];
+      simd_pre [dir][i * TILES_PER_DIM + j] = k;
+      simd_post[dir][k] = i * TILES_PER_DIM + j;
+    }
+  }
+  FOR(m, 0, 16) {
+    u32 c = 0x80808080;
+    i8  n = 0;
+    FOR(j, 0, 4) {
+      if(!(m >> j & 1)) continue;
+      c &= ~(0xffu << (8 * n));
+      c |= (u32)j << (8 * n++);
+    }
+    compact[m] = c;
+  }
+}
+#endif
+
+#ifdef HAVE_SIMD
+// [taken] has a bit set for each lane of [merged] holding a new tile
+static u32 simd_points(const u8 merged[16], u32 taken) {
+  u32 points = 0;
+  for(; taken != 0; taken &= taken - 1)
+    points += 1u << merged[__builtin_ctz(taken)];
+  return points;
+}
+#endif
+
+#if defined(HAVE_SIMD) && !defined(__aarch64__)
+SIMD static __m128i simd_compact(__m128i v) {
+  u32 nz = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+  // shuffle indices with the high bit set (0x80 + row offset) give zeros
+  return _mm_shuffle_epi8(v, _mm_setr_epi32(
+    compact[nz       & 0xf],
+    compact[nz >>  4 & 0xf] + 0x04040404,
+    compact[nz >>  8 & 0xf] + 0x08080808,
+    compact[nz >> 12 & 0xf] + 0x0c0c0c0c));
+}
+
+SIMD static u32 simd_move(struct g2048_board* b, i8 dir) {
+  __m128i v     = _mm_load_si128((const __m128i*)b->tiles);
+  __m128i zero  = _mm_setzero_si128();
+  __m128i pairs = _mm_set1_epi32(0x00ffffff);
+  v = simd_compact(_mm_shuffle_epi8(v,
+        _mm_load_si128((const __m128i*)simd_pre[dir])));
+  // e: tile j equals tile j+1; a run of three only merges its first pair, so
+  // the pair at j is taken unless j-1 was, i.e. unless e[j-1] and not e[j-2]
+  __m128i e = _mm_and_si128(pairs, _mm_cmpeq_epi8(v, _mm_srli_si128(v, 1)));
+  e = _mm_andnot_si128(_mm_cmpeq_epi8(v, zero), e);
+  __m128i taken = _mm_andnot_si128(
+    _mm_andnot_si128(_mm_slli_si128(e, 2), _mm_slli_si128(e, 1)), e);
+  v = _mm_sub_epi8(v, taken);
+  v = _mm_andnot_si128(_mm_slli_si128(taken, 1), v);
+  u8 merged[16] align(16);
+  _mm_store_si128((__m128i*)merged, v);
+  v = _mm_shuffle_epi8(simd_compact(v),
+        _mm_load_si128((const __m128i*)simd_post[dir]));
+  _mm_store_si128((__m128i*)b->tiles, v);
+  return simd_points(merged, _mm_movemask_epi8(taken));
+}
+
+static bool simd_supported(void) { return __builtin_cpu_supports("ssse3"); }
+#endif
+
+#if defined(HAVE_SIMD) && defined(__aarch64__)
+static uint8x16_t simd_compact(uint8x16_t v) {
+  static const u8 bits[16] = { 1, 2, 4, 8, 1, 2, 4, 8, 1, 2, 4, 8, 1, 2, 4, 8 };
+  uint8x16_t nz = vandq_u8(vtstq_u8(v, v), vld1q_u8(bits));
+  nz = vpaddq_u8(nz, nz);
+  nz = vpaddq_u8(nz, nz);
+  u32 m = vgetq_lane_u32(vreinterpretq_u32_u8(nz), 0);
+  // out of range indices (0x80 + row offset) give zeros
+  uint32x4_t c =
+    { compact[m       & 0xf]
+    , compact[m >>  8 & 0xf] + 0x04040404
+    , compact[m >> 16 & 0xf] + 0x08080808
+    , compact[m >> 24 & 0xf] + 0x0c0c0c0c
+    };
+  return vqtbl1q_u8(v, vreinterpretq_u8_u32(c));
+}
+
+static u32 simd_move(struct g2048_board* b, i8 dir) {
+  uint8x16_t v     = vld1q_u8(&b->tiles[0][0]);
+  uint8x16_t zero  = vdupq_n_u8(0);
+  uint8x16_t pairs = vreinterpretq_u8_u32(vdupq_n_u32(0x00ffffff));
+  v = simd_compact(vqtbl1q_u8(v, vld1q_u8(simd_pre[dir])));
+  // see the SSE kernel
+  uint8x16_t e = vandq_u8(vandq_u8(pairs, vtstq_u8(v, v)),
+                          vceqq_u8(v, vextq_u8(v, zero, 1)));
+  uint8x16_t taken = vbicq_u8(e,
+    vbicq_u8(vextq_u8(zero, e, 15), vextq_u8(zero, e, 14)));
+  v = vsubq_u8(v, taken);
+  v = vbicq_u8(v, vextq_u8(zero, taken, 15));
+  u8 merged[16], lanes[16];
+  vst1q_u8(merged, v);
+  vst1q_u8(lanes, taken);
+  v = vqtbl1q_u8(simd_compact(v), vld1q_u8(simd_post[dir]));
+  vst1q_u8(&b->tiles[0][0], v);
+  u32 mask = 0;
+  FOR(k, 0, 16) mask |= (u32)(lanes[k] & 1) << k;
+  return simd_points(merged, mask);
+}
+
+static bool simd_supported(void) { return true; }
+#endif
+
+#ifdef PACKED
+u16 g2048_row_left [ROWS];
+u16 g2048_row_right[ROWS];
+u32 g2048_row_score[ROWS];
+
+u64 g2048_col_up  [ROWS];
+u64 g2048_col_down[ROWS];
+
+u8 g2048_row_moves[ROWS];
+u8 g2048_col_moves[ROWS];
+
+static u64 row_to_col(u16 r) {
+  u64 c = 0;
+  FOR(i, 0, TILES_PER_DIM) c |= (u64)((r >> (4 * i)) & 0xf) << NIBBLE(i, 0);
+  return c;
+}
+
+static u16 reverse_row(u16 r) {
+  u16 v = 0;
+  FOR(j, 0, TILES_PER_DIM)
+    v |= ((r >> (4 * j)) & 0xf) << (4 * (TILES_PER_DIM - 1 - j));
+  return v;
+}
+
+static void init_row_tables(void) {
+  for(u32 r = 0; r < ROWS; ++r) {
+    u8 row[TILES_PER_DIM];
+    FOR(j, 0, TILES_PER_DIM) row[j] = (r >> (4 * j)) & 0xf;
+    u32 score = merge_row_left(row);
+    u16 left  = 0;
+    bool fits = true;
+    FOR(j, 0, TILES_PER_DIM) {
+      fits &= row[j] < 16;
+      left |= row[j] << (4 * j);
+    }
+    if(!fits) {
+      left  = r;
+      score = 0;
+    }
+    g2048_row_left[r] = left;
+    g2048_row_score[r] = score;
+    g2048_row_right[reverse_row(r)] = reverse_row(left);
+  }
+  for(u32 r = 0; r < ROWS; ++r) {
+    g2048_col_up  [r] = row_to_col(g2048_row_left [r]);
+    g2048_col_down[r] = row_to_col(g2048_row_right[r]);
+    bool left  = g2048_row_left [r] != r;
+    bool right = g2048_row_right[r] != r;
+    g2048_row_moves[r] = left << LEFT | right << RIGHT;
+    g2048_col_moves[r] = left << UP   | right << DOWN;
+  }
+}
+
+static u32 table_move(struct g2048_board* b, i8 dir) {
+  u32 points = 0;
+  g2048_unpack_board(g2048_bb_move(g2048_pack_board(b), dir, &points), b);
+  return points;
+}
+#endif
+
+// On 5x5 the rows are 20 bits as nibbles, so a table of every row moved left
+// is 2^20 entries, 4MB, and needs no packed board: each line is read off the
+// byte board toward where it moves, looked up, and written back. Lines with
+// a 2^15 tile, whose merges don't fit a nibble, are merged by the scalar
+// code instead. 6x6 rows would need 2^24 entries, 64MB a table.
+#if TILES_PER_DIM == 5
+#define LINE_ROWS (1 << (4 * TILES_PER_DIM))
+
+static u32 line_left [LINE_ROWS];
+static u32 line_score[LINE_ROWS];
+// line_at[dir][i][j] is where tile j of line i is on the board, counting
+// from the end it moves toward
+static u8  line_at[4][TILES_PER_DIM][TILES_PER_DIM];
+
+static void init_line_tables(void) {
+  for(u32 r = 0; r < LINE_ROWS; ++r) {
+    u8 row[TILES_PER_DIM];
+    FOR(j, 0, TILES_PER_DIM) row[j] = (r >> (4 * j)) & 0xf;
+    line_score[r] = merge_row_left(row);
+    FOR(j, 0, TILES_PER_DIM) line_left[r] |= (u32)(row[j] & 0xf) << (4 * j);
+  }
+  FOR(dir, 0, 4) FOR_TILES(i, j) {
+    i8 k = dir == RIGHT || dir == DOWN ? TILES_PER_DIM - 1 - j : j;
+    line_at[dir][i][j] = dir == LEFT || dir == RIGHT ? i * TILES_PER_DIM + k
+                                                     : k * TILES_PER_DIM + i;
+  }
+}
+
+static u32 line_move(struct g2048_board* b, i8 dir) {
+  u8* t      = &b->tiles[0][0];
+  u32 points = 0;
+  FOR(i, 0, TILES_PER_DIM) {
+    const u8* at = line_at[dir][i];
+    u8   row[TILES_PER_DIM];
+    u32  r    = 0;
+    bool fits = true;
+    FOR(j, 0, TILES_PER_DIM) {
+      row[j] = t[at[j]];
+      fits  &= row[j] < 15;
+      r     |= (u32)row[j] << (4 * j);
+    }
+    if(fits) {
+      points += line_score[r];
+      FOR(j, 0, TILES_PER_DIM) row[j] = (line_left[r] >> (4 * j)) & 0xf;
+    } else {
+      points += merge_row_left(row);
+    }
+    FOR(j, 0, TILES_PER_DIM) t[at[j]] = row[j];
+  }
+  return points;
+}
+#endif
+
+const struct g2048_backend g2048_backends[] =
+  {
+#ifdef HAVE_SIMD
+    { "simd",   simd_move,   simd_supported },
+#endif
+#ifdef PACKED
+    { "table",  table_move,  NULL },
+#elif TILES_PER_DIM == 5
+    { "table",  line_move,   NULL },
+#endif
+    { "scalar", scalar_move, NULL },
+  };
+
+const u8 g2048_backend_count =
+  sizeof(g2048_backends) / sizeof(g2048_backends[0]);
+const struct g2048_backend* g2048_backend;
+
+// runs before main, or when the shared library is loaded, so the engine is
+// ready with no call to set it up
+__attribute__((constructor))
+static void init_engine(void) {
+#ifdef INSTRUMENT
+  init_probes();
+#endif
+#ifdef PACKED
+  init_row_tables();
+#elif TILES_PER_DIM == 5
+  init_line_tables();
+#endif
+#ifdef HAVE_SIMD
+  init_simd_tables();
+#endif
+#ifndef PACKED
+  g2048_backend = &g2048_backends[0];
+  while(!g2048_backend_supported(g2048_backend)) ++g2048_backend;
+#endif
+}
@@ -0,0 +1,599 @@
+// The engine of the game: boards, moves, new tiles and whether a game is won
+// or lost, and nothing else, so it builds without curses into lib2048.a and
+// lib2048.so. It allocates nothing and takes no locks. The hot path is all
+// inline here; the library holds the tables and move kernels behind it, and
+// sets them up before main. A client must be built with the same
+// TILES_PER_DIM, TARGET_TILE and INITIAL_TILES as the library it links.
+// Everything this header defines, and every symbol the library exports,
+// starts with g2048_ or G2048_.
+#ifndef G2048_ENGINE_H
+#define G2048_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// 2^11 = 2048
+#ifdef TARGET_TILE
+#define G2048_TARGET_TILE TARGET_TILE
+#else
+#define G2048_TARGET_TILE 11
+#endif
+#ifdef INITIAL_TILES
+#define G2048_INITIAL_TILES INITIAL_TILES
+#else
+#define G2048_INITIAL_TILES 2
+#endif
+// build with -DTILES_PER_DIM=n for an n x n board, 3 <= n <= 8
+#ifdef TILES_PER_DIM
+#define G2048_TILES_PER_DIM TILES_PER_DIM
+#else
+#define G2048_TILES_PER_DIM 4
+#endif
+#define G2048_CELLS (G2048_TILES_PER_DIM * G2048_TILES_PER_DIM)
+
+#if G2048_TILES_PER_DIM < 3 || G2048_TILES_PER_DIM > 8
+#error "TILES_PER_DIM must be between 3 and 8"
+#endif
+
+// boards whose tiles fit in a u64 and whose rows fit in a u16 also get the
+// packed board, its row tables and the solver. 5x5 has a table of its 20-bit
+// rows for the byte board; 6x6 and up move with the scalar kernel, as a table
+// of their rows would be 64MB or more.
+#if G2048_TILES_PER_DIM <= 4
+#define G2048_PACKED 1
+#endif
+
+// If a tile at (i, j) is present, tiles[i][j] contains its log_2 value.
+// If a tile at (i, j) is not present, tiles[i][j] = 0.
+struct g2048_board {
+  uint8_t tiles[G2048_TILES_PER_DIM][G2048_TILES_PER_DIM]
+    __attribute__((aligned(16)));
+};
+
+// xoshiro128**: small, fast, and good enough for games and simulations.
+struct g2048_rng {
+  uint32_t s[4];
+};
+
+// scores on boards past 5x5 can outgrow a u32
+struct g2048_game {
+  struct g2048_board board;
+  uint64_t           score;
+  struct g2048_rng   rng;
+};
+
+enum g2048_dir { G2048_LEFT, G2048_DOWN, G2048_RIGHT, G2048_UP };
+
+// Built with -DINSTRUMENT, G2048_PROBE(p) at the top of a function counts its
+// calls and their time into a histogram by powers of two of ticks: the TSC on
+// x86, nanoseconds elsewhere. The counts go to stderr at exit, and after a
+// SIGUSR1, which only sets a flag: the dump waits for the next probed call.
+// Without INSTRUMENT, it is nothing.
+#ifdef INSTRUMENT
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t g2048_ticks(void) { return __rdtsc(); }
+#else
+static inline uint64_t g2048_ticks(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#endif
+
+enum g2048_probe
+  { G2048_PROBE_UPDATE
+  , G2048_PROBE_IS_LOSS
+  , G2048_PROBE_NEW_TILE
+  , G2048_PROBE_DRAW
+  , G2048_PROBES
+  };
+
+struct g2048_probe_timer {
+  enum g2048_probe p;
+  uint64_t         start;
+};
+
+void g2048_probe_end(struct g2048_probe_timer* t);
+
+// A program that owns the terminal, or sits idle between probed calls, sets
+// g2048_probe_polled: then probed calls leave a SIGUSR1's dump to it, and it
+// calls g2048_probe_dump where it can print once g2048_probe_waiting().
+extern bool g2048_probe_polled;
+bool g2048_probe_waiting(void);
+void g2048_probe_dump(void);
+
+#define G2048_PROBE(p) \
+  struct g2048_probe_timer g2048_probe_timer \
+    __attribute__((cleanup(g2048_probe_end))) = { (p), g2048_ticks() }
+#else
+#define G2048_PROBE(p)
+#endif
+
+static inline uint32_t g2048_rotl(uint32_t x, int k) {
+  return (x << k) | (x >> (32 - k));
+}
+
+static inline uint32_t g2048_rng_next(struct g2048_rng* r) {
+  uint32_t* s = r->s;
+  uint32_t  x = g2048_rotl(s[1] * 5, 7) * 9;
+  uint32_t  t = s[1] << 9;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3]  = g2048_rotl(s[3], 11);
+  return x;
+}
+
+// the state is filled in by splitmix64, so any seed, even 0, is fine
+static inline struct g2048_rng g2048_rng_seed(uint64_t seed) {
+  struct g2048_rng r;
+  for(int i = 0; i < 2; ++i) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    r.s[2*i]   = z;
+    r.s[2*i+1] = z >> 32;
+  }
+  return r;
+}
+
+// uniform in [0, n): the high half of a 32x32 bit product, redrawn in the
+// rare case the low half lands in the sliver that would bias it
+static inline uint32_t g2048_rng_below(struct g2048_rng* r, uint32_t n) {
+  uint64_t m = (uint64_t)g2048_rng_next(r) * n;
+  if((uint32_t)m < n) {
+    uint32_t threshold = -n % n;
+    while((uint32_t)m < threshold) m = (uint64_t)g2048_rng_next(r) * n;
+  }
+  return m >> 32;
+}
+
+#define G2048_WORDS ((G2048_CELLS + 7) / 8)
+
+// bit i * TILES_PER_DIM + j is set iff tiles[i][j] is empty
+static inline uint64_t g2048_empty_mask(const struct g2048_board* b) {
+  // bytes past the last tile read as nonzero, so they never look empty
+  uint64_t words[G2048_WORDS];
+  memset(words, 0xff, sizeof(words));
+  memcpy(words, b->tiles, G2048_CELLS);
+  uint64_t mask = 0;
+  for(int i = 0; i < G2048_WORDS; ++i) {
+    uint64_t x = words[i];
+    // the high bit of each zero byte, gathered into the top byte
+    uint64_t z = ~(((x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | x)
+               & 0x8080808080808080ull;
+    mask |= (((z >> 7) * 0x0102040810204080ull) >> 56) << (8 * i);
+  }
+  return mask;
+}
+
+static inline void g2048_new_tile(struct g2048_board* b, struct g2048_rng* r) {
+  G2048_PROBE(G2048_PROBE_NEW_TILE);
+  uint64_t empty = g2048_empty_mask(b);
+  int      tile  = g2048_rng_below(r, __builtin_popcountll(empty));
+  // 10% chance of 4, 90% chance of 2
+  uint8_t tile_size = 1 + (g2048_rng_below(r, 10) == 0);
+  for(int i = 0; i < tile; ++i) empty &= empty - 1;
+  int k = __builtin_ctzll(empty);
+  b->tiles[k / G2048_TILES_PER_DIM][k % G2048_TILES_PER_DIM] = tile_size;
+}
+
+// A packed board holds the same log_2 values as a struct g2048_board, one
+// nibble per tile: tiles[i][j] lives at bit G2048_NIBBLE(i, j), so row i is
+// the G2048_ROW_BITS-bit word (p >> (G2048_ROW_BITS * i)). Two packed boards
+// are equal iff their integers are, and tiles past 2^15 don't fit.
+#ifdef G2048_PACKED
+#define G2048_NIBBLE(i, j) (4 * ((i) * G2048_TILES_PER_DIM + (j)))
+#define G2048_ROW_BITS     (4 * G2048_TILES_PER_DIM)
+#define G2048_ROWS         (1 << G2048_ROW_BITS)
+// the low bit of every tile's nibble
+#define G2048_LOW_BITS     (0x1111111111111111ull >> (64 - 4 * G2048_CELLS))
+
+// a 4x4 board's 16 bytes are two words, squeezed into nibbles, and spread
+// back out, with shifts and masks
+static inline uint64_t g2048_pack_board(const struct g2048_board* b) {
+#if G2048_TILES_PER_DIM != 4
+  uint64_t p = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      p |= (uint64_t)b->tiles[i][j] << G2048_NIBBLE(i, j);
+  return p;
+#else
+  uint64_t w[2];
+  memcpy(w, b->tiles, sizeof(w));
+  for(int k = 0; k < 2; ++k) {
+    w[k] = (w[k] | w[k] >> 4)  & 0x00ff00ff00ff00ffull;
+    w[k] = (w[k] | w[k] >> 8)  & 0x0000ffff0000ffffull;
+    w[k] = (w[k] | w[k] >> 16) & 0x00000000ffffffffull;
+  }
+  return w[0] | w[1] << 32;
+#endif
+}
+
+static inline void g2048_unpack_board(uint64_t p, struct g2048_board* b) {
+#if G2048_TILES_PER_DIM != 4
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      b->tiles[i][j] = (p >> G2048_NIBBLE(i, j)) & 0xf;
+#else
+  uint64_t w[2] = { p & 0xffffffff, p >> 32 };
+  for(int k = 0; k < 2; ++k) {
+    w[k] = (w[k] | w[k] << 16) & 0x0000ffff0000ffffull;
+    w[k] = (w[k] | w[k] << 8)  & 0x00ff00ff00ff00ffull;
+    w[k] = (w[k] | w[k] << 4)  & 0x0f0f0f0f0f0f0f0full;
+  }
+  memcpy(b->tiles, w, sizeof(w));
+#endif
+}
+
+static inline uint8_t g2048_bb_tile(uint64_t p, int i, int j) {
+  return (p >> G2048_NIBBLE(i, j)) & 0xf;
+}
+
+// the low bit of each empty tile's nibble
+static inline uint64_t g2048_bb_empty(uint64_t p) {
+  // the low bit of each nibble becomes the OR of all four of its bits
+  uint64_t occupied = (p | p >> 1 | p >> 2 | p >> 3) & G2048_LOW_BITS;
+  return occupied ^ G2048_LOW_BITS;
+}
+
+static inline int8_t g2048_bb_count_zeros(uint64_t p) {
+  return __builtin_popcountll(g2048_bb_empty(p));
+}
+
+// swaps tiles (i, j) and (j, i) by moving the 2x2 blocks of nibbles, then
+// the 2x2 blocks of those
+static inline uint64_t g2048_bb_transpose(uint64_t p) {
+#if G2048_TILES_PER_DIM != 4
+  uint64_t t = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      t |= (uint64_t)g2048_bb_tile(p, i, j) << G2048_NIBBLE(j, i);
+  return t;
+#else
+  uint64_t a = (p & 0xf0f00f0ff0f00f0full)
+             | (p & 0x0000f0f00000f0f0ull) << 12
+             | (p & 0x0f0f00000f0f0000ull) >> 12;
+  return (a & 0xff00ff0000ff00ffull)
+       | (a & 0x00ff00ff00000000ull) >> 24
+       | (a & 0x00000000ff00ff00ull) << 24;
+#endif
+}
+
+// reverses the tiles of each row
+static inline uint64_t g2048_bb_mirror(uint64_t p) {
+#if G2048_TILES_PER_DIM != 4
+  uint64_t m = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      m |= (uint64_t)g2048_bb_tile(p, i, j)
+           << G2048_NIBBLE(i, G2048_TILES_PER_DIM - 1 - j);
+  return m;
+#else
+  return (p & 0x000f000f000f000full) << 12 | (p & 0x00f000f000f000f0ull) << 4
+       | (p >> 4 & 0x00f000f000f000f0ull)  | (p >> 12 & 0x000f000f000f000full);
+#endif
+}
+
+// reverses the order of the rows
+static inline uint64_t g2048_bb_flip(uint64_t p) {
+#if G2048_TILES_PER_DIM != 4
+  uint64_t f = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      f |= (uint64_t)g2048_bb_tile(p, i, j)
+           << G2048_NIBBLE(G2048_TILES_PER_DIM - 1 - i, j);
+  return f;
+#else
+  return p << 48 | (p << 16 & 0x0000ffff00000000ull)
+       | (p >> 16 & 0x00000000ffff0000ull) | p >> 48;
+#endif
+}
+
+// The 8 symmetries of a board are transforms t: transpose it if t & 4, then
+// mirror it if t & 1, then flip it if t & 2. A board, its value and its
+// legal moves are the same under all of them, up to where the moves point.
+// Returns the least of the images of [p], and its transform in [*t].
+static inline uint64_t g2048_bb_canonical(uint64_t p, int8_t* t) {
+  uint64_t q = g2048_bb_transpose(p);
+  uint64_t m = g2048_bb_mirror(p), n = g2048_bb_mirror(q);
+  uint64_t images[8] = { p, m, g2048_bb_flip(p), g2048_bb_flip(m),
+                         q, n, g2048_bb_flip(q), g2048_bb_flip(n) };
+  uint64_t min = p;
+  *t = 0;
+  for(int k = 1; k < 8; ++k)
+    if(images[k] < min) {
+      min = images[k];
+      *t  = k;
+    }
+  return min;
+}
+
+// the move on the original board that [dir] is on its image under t
+static inline int8_t g2048_untransform_dir(int8_t t, int8_t dir) {
+  // a flip swaps UP and DOWN, a mirror LEFT and RIGHT, a transpose LEFT and
+  // UP, and RIGHT and DOWN; each undoes itself, so undo them in reverse
+  if(t & 2 &&  (dir & 1)) dir ^= 2;
+  if(t & 1 && !(dir & 1)) dir ^= 2;
+  if(t & 4)               dir  = 3 - dir;
+  return dir;
+}
+
+static inline uint16_t g2048_bb_row(uint64_t p, int i) {
+  return (p >> (G2048_ROW_BITS * i)) & (G2048_ROWS - 1);
+}
+
+// Every packed row, moved left and moved right. A row scores the same points
+// either way, since each run of equal tiles merges the same number of pairs.
+// Rows whose merge would need a 2^16 tile are left as they are.
+extern uint16_t g2048_row_left [G2048_ROWS];
+extern uint16_t g2048_row_right[G2048_ROWS];
+extern uint32_t g2048_row_score[G2048_ROWS];
+
+// The same moves, read off a row of the transposed board and spread back out
+// into column 0 of the untransposed one.
+extern uint64_t g2048_col_up  [G2048_ROWS];
+extern uint64_t g2048_col_down[G2048_ROWS];
+
+// the directions that change a row, as bits 1 << dir: LEFT and RIGHT for a
+// row of the board, UP and DOWN for a row of the transposed board
+extern uint8_t g2048_row_moves[G2048_ROWS];
+extern uint8_t g2048_col_moves[G2048_ROWS];
+
+static inline uint64_t g2048_bb_merge_left(uint64_t p) {
+  uint64_t r = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    r |= (uint64_t)g2048_row_left[g2048_bb_row(p, i)] << (G2048_ROW_BITS * i);
+  return r;
+}
+
+static inline uint64_t g2048_bb_merge_right(uint64_t p) {
+  uint64_t r = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    r |= (uint64_t)g2048_row_right[g2048_bb_row(p, i)] << (G2048_ROW_BITS * i);
+  return r;
+}
+
+static inline uint64_t g2048_bb_merge_up(uint64_t p) {
+  uint64_t t = g2048_bb_transpose(p), r = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    r |= g2048_col_up[g2048_bb_row(t, i)] << (4 * i);
+  return r;
+}
+
+static inline uint64_t g2048_bb_merge_down(uint64_t p) {
+  uint64_t t = g2048_bb_transpose(p), r = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    r |= g2048_col_down[g2048_bb_row(t, i)] << (4 * i);
+  return r;
+}
+
+static inline uint64_t g2048_bb_merge(uint64_t p, int8_t dir) {
+  switch(dir) {
+  case G2048_LEFT:  return g2048_bb_merge_left (p);
+  case G2048_DOWN:  return g2048_bb_merge_down (p);
+  case G2048_RIGHT: return g2048_bb_merge_right(p);
+  default:          return g2048_bb_merge_up   (p);
+  }
+}
+
+static inline uint32_t g2048_bb_row_points(uint64_t p) {
+  uint32_t points = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    points += g2048_row_score[g2048_bb_row(p, i)];
+  return points;
+}
+
+// adds the points scored to [*points]
+static inline uint64_t g2048_bb_move(uint64_t p, int8_t dir, uint32_t* points) {
+  switch(dir) {
+  case G2048_LEFT:
+    *points += g2048_bb_row_points(p);
+    return g2048_bb_merge_left(p);
+  case G2048_RIGHT:
+    *points += g2048_bb_row_points(p);
+    return g2048_bb_merge_right(p);
+  case G2048_DOWN:
+    *points += g2048_bb_row_points(g2048_bb_transpose(p));
+    return g2048_bb_merge_down(p);
+  default:
+    *points += g2048_bb_row_points(g2048_bb_transpose(p));
+    return g2048_bb_merge_up(p);
+  }
+}
+
+static inline bool g2048_bb_is_victory(uint64_t p) {
+  bool r = false;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      r |= g2048_bb_tile(p, i, j) >= G2048_TARGET_TILE;
+  return r;
+}
+
+// bit 1 << dir is set iff moving in dir changes the board, so the game is
+// lost iff none is
+static inline uint8_t g2048_bb_legal_moves(uint64_t p) {
+  uint64_t t = g2048_bb_transpose(p);
+  uint8_t  m = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    m |= g2048_row_moves[g2048_bb_row(p, i)]
+       | g2048_col_moves[g2048_bb_row(t, i)];
+  return m;
+}
+#endif
+
+// Every way of moving a struct g2048_board, all with the same results,
+// fastest first. The scalar one is the reference.
+struct g2048_backend {
+  const char* name;
+  uint32_t (*merge)(struct g2048_board* b, int8_t dir);
+  bool     (*supported)(void);
+};
+
+extern const struct g2048_backend  g2048_backends[];
+extern const uint8_t               g2048_backend_count;
+// The backend g2048_move calls. With packed boards it is NULL, unless set:
+// then moves go through the row tables inline, with no call at all. Without
+// them it starts as the fastest backend supported.
+extern const struct g2048_backend* g2048_backend;
+
+static inline bool g2048_backend_supported(const struct g2048_backend* be) {
+  return be->supported == NULL || be->supported();
+}
+
+// moves [*b] in [dir], and returns the points scored
+static inline uint32_t g2048_move(struct g2048_board* b, int8_t dir) {
+#ifdef G2048_PACKED
+  if(g2048_backend == NULL) {
+    uint32_t points = 0;
+    g2048_unpack_board(g2048_bb_move(g2048_pack_board(b), dir, &points), b);
+    return points;
+  }
+#endif
+  return g2048_backend->merge(b, dir);
+}
+
+static inline bool g2048_is_victory(const struct g2048_board* b) {
+#ifdef G2048_PACKED
+  return g2048_bb_is_victory(g2048_pack_board(b));
+#else
+  bool r = false;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      r |= b->tiles[i][j] >= G2048_TARGET_TILE;
+  return r;
+#endif
+}
+
+// A move changes the board iff some tile has an empty tile, or an equal
+// one, next to it in that direction.
+static inline uint8_t g2048_legal_moves(const struct g2048_board* b) {
+#ifdef G2048_PACKED
+  return g2048_bb_legal_moves(g2048_pack_board(b));
+#else
+  uint8_t m = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM - 1; ++j) {
+      uint8_t l = b->tiles[i][j], r = b->tiles[i][j + 1];
+      uint8_t u = b->tiles[j][i], d = b->tiles[j + 1][i];
+      if(r != 0 && (l == 0 || l == r)) m |= 1 << G2048_LEFT;
+      if(l != 0 && (r == 0 || l == r)) m |= 1 << G2048_RIGHT;
+      if(d != 0 && (u == 0 || u == d)) m |= 1 << G2048_UP;
+      if(u != 0 && (d == 0 || u == d)) m |= 1 << G2048_DOWN;
+    }
+  return m;
+#endif
+}
+
+static inline bool g2048_is_loss(const struct g2048_board* b) {
+  G2048_PROBE(G2048_PROBE_IS_LOSS);
+  return g2048_legal_moves(b) == 0;
+}
+
+// false if [dir] doesn't change the board
+static inline bool g2048_update(struct g2048_game* g, int8_t dir) {
+  G2048_PROBE(G2048_PROBE_UPDATE);
+  uint32_t points = 0;
+#ifdef G2048_PACKED
+  if(g2048_backend == NULL) {
+    uint64_t p = g2048_pack_board(&g->board);
+    uint64_t q = g2048_bb_move(p, dir, &points);
+    if(q == p) return false;
+    g2048_unpack_board(q, &g->board);
+  } else
+#endif
+  {
+    struct g2048_board b0 = g->board;
+    points = g2048_backend->merge(&g->board, dir);
+    if(memcmp(g->board.tiles, b0.tiles, sizeof(b0.tiles)) == 0) return false;
+  }
+  g->score += points;
+  g2048_new_tile(&g->board, &g->rng);
+  return true;
+}
+
+static inline struct g2048_game g2048_new_game(uint64_t seed) {
+  struct g2048_game g =
+    { .board = { .tiles = {{0}} }
+    , .score = 0
+    , .rng   = g2048_rng_seed(seed)
+    };
+  for(int i = 0; i < G2048_INITIAL_TILES; ++i)
+    g2048_new_tile(&g.board, &g.rng);
+  return g;
+}
+
+// A game as it was before some moves, to go back to: with packed boards the
+// board and score are two words, and the rng is kept so that moves made
+// again after going back get the same new tiles.
+struct g2048_snapshot {
+#ifdef G2048_PACKED
+  uint64_t           board;
+#else
+  struct g2048_board board;
+#endif
+  uint64_t           score;
+  struct g2048_rng   rng;
+};
+
+static inline struct g2048_snapshot
+g2048_take_snapshot(const struct g2048_game* g) {
+#ifdef G2048_PACKED
+  struct g2048_snapshot s = { g2048_pack_board(&g->board), g->score, g->rng };
+#else
+  struct g2048_snapshot s = { g->board, g->score, g->rng };
+#endif
+  return s;
+}
+
+static inline void g2048_restore_snapshot(struct g2048_game* g,
+                                          const struct g2048_snapshot* s) {
+#ifdef G2048_PACKED
+  g2048_unpack_board(s->board, &g->board);
+#else
+  g->board = s->board;
+#endif
+  g->score = s->score;
+  g->rng   = s->rng;
+}
+
+// The last G2048_HISTORY games pushed, as a stack for make/unmake that
+// forgets its bottom once full: push and pop are O(1), and copy one snapshot.
+#define G2048_HISTORY 64
+
+struct g2048_history {
+  struct g2048_snapshot at[G2048_HISTORY];
+  uint32_t              top;  // pushes less pops, mod 2^32
+  uint32_t              n;    // how many pops are left
+};
+
+static inline void g2048_push_game(struct g2048_history* h,
+                                   const struct g2048_game* g) {
+  h->at[h->top++ % G2048_HISTORY] = g2048_take_snapshot(g);
+  if(h->n < G2048_HISTORY) h->n += 1;
+}
+
+// false, leaving [*g] alone, if there is nothing to go back to
+static inline bool g2048_pop_game(struct g2048_history* h,
+                                  struct g2048_game* g) {
+  if(h->n == 0) return false;
+  h->n -= 1;
+  g2048_restore_snapshot(g, &h->at[--h->top % G2048_HISTORY]);
+  return true;
+}
+
+static inline uint8_t g2048_max_tile(const struct g2048_board* b) {
+  uint8_t m = 0;
+  for(int i = 0; i < G2048_TILES_PER_DIM; ++i)
+    for(int j = 0; j < G2048_TILES_PER_DIM; ++j)
+      if(b->tiles[i][j] > m) m = b->tiles[i][j];
+  return m;
+}
+
+#endif
@@ -0,0 +1,49 @@
+// Short names for the engine's own code and the game's, on top of engine.h.
+// None of this is part of the library's interface, and clients of
+// lib2048 shouldn't include it.
+#ifndef G2048_INTERNAL_H
+#define G2048_INTERNAL_H
+
+#include "engine.h"
+
+#ifndef INITIAL_TILES
+#define INITIAL_TILES G2048_INITIAL_TILES
+#endif
+#ifndef TILES_PER_DIM
+#define TILES_PER_DIM G2048_TILES_PER_DIM
+#endif
+#define CELLS G2048_CELLS
+
+#ifdef G2048_PACKED
+#define PACKED       1
+#define NIBBLE(i, j) G2048_NIBBLE(i, j)
+#define ROWS         G2048_ROWS
+#endif
+
+#define i8  int8_t
+#define u8  uint8_t
+#define u16 uint16_t
+#define u32 uint32_t
+#define u64 uint64_t
+
+#define align(n) __attribute__((aligned(n)))
+
+#define FOR(i, s, n) \
+  for(i8 i = s; i < n; ++i)
+
+#define FOR_TILES(i, j) \
+  FOR(i, 0, TILES_PER_DIM) \
+  FOR(j, 0, TILES_PER_DIM)
+
+#define LEFT  G2048_LEFT
+#define DOWN  G2048_DOWN
+#define RIGHT G2048_RIGHT
+#define UP    G2048_UP
+
+#define PROBE(p)   G2048_PROBE(p)
+#define PROBE_DRAW G2048_PROBE_DRAW
+#define PROBES     G2048_PROBES
+
+#define BACKENDS g2048_backend_count
+
+#endif